@@ -60,17 +60,3 @@ inline float srgb_encode(float f) {
 inline uint32_t round_up(uint32_t k, uint32_t alignment) {
     return (k + alignment - 1) & ~(alignment - 1);
 }
-
-#if 0
-#define START_TIMER { Timestamp t;
-#define STOP_TIMER(message) \
-	auto d = elapsed_nanoseconds(t); \
-	static Timestamp t0; \
-	if (elapsed_milliseconds(t0) > 1000) { \
-		t0 = Timestamp(); \
-		printf(message ## " time = %lld  microseconds\n", d / 1000); } }
-
-#else
-#define START_TIMER
-#define STOP_TIMER(...)
-#endif
@@ -0,0 +1,170 @@
+#include "common.h"
+#include "compute_tuning.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+// Tuning results. Each line has format: <device key> <pass name> <size x> <size y>
+static const char* cache_file = "workgroup_size_cache.txt";
+
+static const Workgroup_Size candidate_sizes[] = {
+    {8, 4}, {8, 8}, {16, 4}, {16, 8}, {16, 16}, {32, 4}, {32, 8}, {32, 16}, {32, 32}, {64, 1}, {64, 4}
+};
+
+namespace {
+struct Cache_Entry {
+    std::string     device_key;
+    std::string     pass_name;
+    Workgroup_Size  size;
+};
+}
+
+// Device UUID is combined with driver version because the best size depends on the driver too.
+static std::string get_device_key() {
+    VkPhysicalDeviceIDProperties id_properties { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES };
+    VkPhysicalDeviceProperties2 properties { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    properties.pNext = &id_properties;
+    vkGetPhysicalDeviceProperties2(vk.physical_device, &properties);
+
+    char key[2*VK_UUID_SIZE + 10];
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++)
+        snprintf(key + 2*i, 3, "%02x", id_properties.deviceUUID[i]);
+    snprintf(key + 2*VK_UUID_SIZE, 10, "-%08x", properties.properties.driverVersion);
+    return key;
+}
+
+static std::vector<Cache_Entry> load_cache() {
+    std::vector<Cache_Entry> entries;
+    std::ifstream file(get_resource_path(cache_file));
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream stream(line);
+        Cache_Entry entry;
+        if (stream >> entry.device_key >> entry.pass_name >> entry.size.x >> entry.size.y)
+            entries.push_back(entry);
+    }
+    return entries;
+}
+
+static void save_cache(const std::vector<Cache_Entry>& entries) {
+    std::ofstream file(get_resource_path(cache_file));
+    if (!file) {
+        printf("failed to write workgroup size cache: %s\n", get_resource_path(cache_file).c_str());
+        return;
+    }
+    for (const Cache_Entry& entry : entries)
+        file << entry.device_key << " " << entry.pass_name << " " << entry.size.x << " " << entry.size.y << "\n";
+}
+
+static bool is_workgroup_size_supported(Workgroup_Size size) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(vk.physical_device, &properties);
+    const VkPhysicalDeviceLimits& limits = properties.limits;
+
+    return size.x <= limits.maxComputeWorkGroupSize[0] &&
+           size.y <= limits.maxComputeWorkGroupSize[1] &&
+           size.x * size.y <= limits.maxComputeWorkGroupInvocations;
+}
+
+Workgroup_Size get_default_workgroup_size_2d() {
+    VkPhysicalDeviceSubgroupProperties subgroup_properties { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES };
+    VkPhysicalDeviceProperties2 properties { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    properties.pNext = &subgroup_properties;
+    vkGetPhysicalDeviceProperties2(vk.physical_device, &properties);
+    const VkPhysicalDeviceLimits& limits = properties.properties.limits;
+
+    // GPUs need a few subgroups per workgroup to hide latency. CPU implementations (lavapipe, swiftshader)
+    // execute the entire workgroup on a single thread, so small workgroups give better load balancing.
+    uint32_t invocation_count;
+    if (properties.properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU)
+        invocation_count = 64;
+    else
+        invocation_count = std::clamp(4 * subgroup_properties.subgroupSize, 64u, 256u);
+
+    invocation_count = std::min(invocation_count, limits.maxComputeWorkGroupInvocations);
+
+    Workgroup_Size size;
+    size.x = std::min(invocation_count >= 128 ? 16u : 8u, limits.maxComputeWorkGroupSize[0]);
+    size.y = std::clamp(invocation_count / size.x, 1u, limits.maxComputeWorkGroupSize[1]);
+    return size;
+}
+
+static double measure_time_ms(VkPipeline pipeline, Workgroup_Size size, VkQueryPool query_pool,
+    const std::function<void (VkCommandBuffer, VkPipeline, Workgroup_Size)>& record_pass)
+{
+    const int pass_count = 8; // per submit
+    const int run_count = 4; // the first run is a warm-up
+
+    double best_time = Infinity;
+    for (int run = 0; run < run_count; run++) {
+        vk_execute(vk.command_pools[0], vk.queue, [&](VkCommandBuffer command_buffer) {
+            vkCmdResetQueryPool(command_buffer, query_pool, 0, 2);
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+            for (int i = 0; i < pass_count; i++)
+                record_pass(command_buffer, pipeline, size);
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
+        });
+
+        uint64_t timestamps[2];
+        VK_CHECK(vkGetQueryPoolResults(vk.device, query_pool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+        if (run > 0)
+            best_time = std::min(best_time, double(timestamps[1] - timestamps[0]) * vk.timestamp_period_ms / pass_count);
+    }
+    return best_time;
+}
+
+Workgroup_Size select_workgroup_size_2d(const char* pass_name, bool auto_tune,
+    std::function<VkPipeline (Workgroup_Size)> create_pipeline,
+    std::function<void (VkCommandBuffer, VkPipeline, Workgroup_Size)> record_pass)
+{
+    const std::string device_key = get_device_key();
+    std::vector<Cache_Entry> cache = load_cache();
+
+    auto cached_entry = std::find_if(cache.begin(), cache.end(), [&device_key, pass_name](const Cache_Entry& entry) {
+        return entry.device_key == device_key && entry.pass_name == pass_name;
+    });
+
+    if (!auto_tune) {
+        if (cached_entry != cache.end() && is_workgroup_size_supported(cached_entry->size))
+            return cached_entry->size;
+        return get_default_workgroup_size_2d();
+    }
+
+    VkQueryPoolCreateInfo create_info { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+    create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    create_info.queryCount = 2;
+    VkQueryPool query_pool;
+    VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &query_pool));
+
+    Workgroup_Size best_size = get_default_workgroup_size_2d();
+    double best_time = Infinity;
+
+    for (Workgroup_Size size : candidate_sizes) {
+        if (!is_workgroup_size_supported(size))
+            continue;
+
+        VkPipeline pipeline = create_pipeline(size);
+        double time = measure_time_ms(pipeline, size, query_pool, record_pass);
+        vkDestroyPipeline(vk.device, pipeline, nullptr);
+
+        printf("%s: workgroup size %ux%u: %.3f ms\n", pass_name, size.x, size.y, time);
+        if (time < best_time) {
+            best_time = time;
+            best_size = size;
+        }
+    }
+    vkDestroyQueryPool(vk.device, query_pool, nullptr);
+    printf("%s: selected workgroup size %ux%u\n", pass_name, best_size.x, best_size.y);
+
+    if (cached_entry != cache.end())
+        cached_entry->size = best_size;
+    else
+        cache.push_back(Cache_Entry{device_key, pass_name, best_size});
+
+    save_cache(cache);
+    return best_size;
+}
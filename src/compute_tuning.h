@@ -0,0 +1,25 @@
+#pragma once
+
+#include "vk.h"
+
+#include <functional>
+
+struct Workgroup_Size {
+    uint32_t x;
+    uint32_t y;
+};
+
+// Workgroup size for 2D image processing passes selected according to device properties.
+Workgroup_Size get_default_workgroup_size_2d();
+
+// Returns workgroup size of the 2D compute pass for the current device.
+//
+// When auto_tune is false the size cached on disk for this device is used, or the default
+// size if the pass was never tuned on this device.
+//
+// When auto_tune is true all candidate sizes are benchmarked: create_pipeline returns
+// the pipeline specialized for the given workgroup size and record_pass records the pass
+// that uses that pipeline. The fastest size is stored in the cache.
+Workgroup_Size select_workgroup_size_2d(const char* pass_name, bool auto_tune,
+    std::function<VkPipeline (Workgroup_Size)> create_pipeline,
+    std::function<void (VkCommandBuffer, VkPipeline, Workgroup_Size)> record_pass);
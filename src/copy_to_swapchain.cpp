@@ -1,20 +1,106 @@
 #include "copy_to_swapchain.h"
+#include "shader_manager.h"
 #include "utils.h"
 
-void Copy_To_Swapchain::create() {
+#include <functional>
 
-    set_layout = Descriptor_Set_Layout()
+static Descriptor_Template_Data get_descriptor_data(VkSampler linear_sampler, VkImageView src_image_view, VkImageView dst_image_view) {
+    return Descriptor_Template_Data()
+        .sampler        (linear_sampler)
+        .sampled_image  (src_image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+        .storage_image  (dst_image_view);
+}
+
+// Records copy passes between two scratch images of the swapchain size to benchmark workgroup sizes.
+static Workgroup_Size benchmark_workgroup_sizes(const Copy_To_Swapchain& copy_to_swapchain,
+    std::function<VkPipeline (Workgroup_Size)> create_pipeline)
+{
+    Vk_Image src_image = vk_create_image(vk.surface_size.width, vk.surface_size.height, VK_FORMAT_R16G16B16A16_SFLOAT,
+        VK_IMAGE_USAGE_SAMPLED_BIT, "copy_to_swapchain_tuning_src_image");
+    Vk_Image dst_image = vk_create_image(vk.surface_size.width, vk.surface_size.height, VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_USAGE_STORAGE_BIT, "copy_to_swapchain_tuning_dst_image");
+
+    vk_execute(vk.command_pools[0], vk.queue, [&src_image, &dst_image](VkCommandBuffer command_buffer) {
+        vk_cmd_image_barrier(command_buffer, src_image.handle,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,                                  VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED,          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        vk_cmd_image_barrier(command_buffer, dst_image.handle,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,                                  VK_ACCESS_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED,          VK_IMAGE_LAYOUT_GENERAL);
+    });
+
+    const Descriptor_Template_Data descriptor_data = get_descriptor_data(copy_to_swapchain.linear_sampler, src_image.view, dst_image.view);
+
+    // Without push descriptors use separate descriptor pool to return all resources after tuning.
+    VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    if (!copy_to_swapchain.use_push_descriptors) {
+        VkDescriptorPoolSize pool_sizes[] = {
+            {VK_DESCRIPTOR_TYPE_SAMPLER,        1},
+            {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,  1},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,  1},
+        };
+        VkDescriptorPoolCreateInfo create_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+        create_info.maxSets         = 1;
+        create_info.poolSizeCount   = (uint32_t)std::size(pool_sizes);
+        create_info.pPoolSizes      = pool_sizes;
+        VK_CHECK(vkCreateDescriptorPool(vk.device, &create_info, nullptr, &descriptor_pool));
+
+        VkDescriptorSetAllocateInfo alloc_info { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+        alloc_info.descriptorPool     = descriptor_pool;
+        alloc_info.descriptorSetCount = 1;
+        alloc_info.pSetLayouts        = &copy_to_swapchain.set_layout;
+        VK_CHECK(vkAllocateDescriptorSets(vk.device, &alloc_info, &set));
+        vkUpdateDescriptorSetWithTemplate(vk.device, set, copy_to_swapchain.update_template, descriptor_data.infos);
+    }
+
+    auto record_pass = [&copy_to_swapchain, set, &descriptor_data, &dst_image](VkCommandBuffer command_buffer, VkPipeline pipeline, Workgroup_Size size) {
+        const VkPipelineLayout pipeline_layout = copy_to_swapchain.pipeline_layout;
+        Copy_To_Swapchain::Push_Constants push_constants = { {vk.surface_size.width, vk.surface_size.height}, {1.f, 1.f}, Upscale_Filter::bilinear, 0.f };
+        vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+        if (copy_to_swapchain.use_push_descriptors)
+            vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, copy_to_swapchain.update_template, pipeline_layout, 0, descriptor_data.infos);
+        else
+            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &set, 0, nullptr);
+        vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+        vkCmdDispatch(command_buffer, (vk.surface_size.width + size.x - 1) / size.x, (vk.surface_size.height + size.y - 1) / size.y, 1);
+
+        vk_cmd_image_barrier(command_buffer, dst_image.handle,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_SHADER_WRITE_BIT,             VK_ACCESS_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_GENERAL,                VK_IMAGE_LAYOUT_GENERAL);
+    };
+
+    Workgroup_Size size = select_workgroup_size_2d("copy_to_swapchain", true, create_pipeline, record_pass);
+
+    vkDestroyDescriptorPool(vk.device, descriptor_pool, nullptr);
+    src_image.destroy();
+    dst_image.destroy();
+    return size;
+}
+
+void Copy_To_Swapchain::create(bool tune_workgroup_size, Descriptor_Backend descriptor_backend) {
+    use_push_descriptors = (descriptor_backend == Descriptor_Backend::push_descriptors) && vk.push_descriptors_supported;
+
+    // With push descriptors the descriptors are pushed into the command buffer
+    // and no descriptor sets are allocated.
+    Descriptor_Set_Layout layout;
+    layout
         .sampler        (0, VK_SHADER_STAGE_COMPUTE_BIT)
         .sampled_image  (1, VK_SHADER_STAGE_COMPUTE_BIT)
-        .storage_image  (2, VK_SHADER_STAGE_COMPUTE_BIT)
-        .create         ("copy_to_swapchain_set_layout");
+        .storage_image  (2, VK_SHADER_STAGE_COMPUTE_BIT);
+    if (use_push_descriptors)
+        layout.push_descriptors();
+    set_layout = layout.create("copy_to_swapchain_set_layout");
 
     // pipeline layout
     {
         VkPushConstantRange range;
         range.stageFlags    = VK_SHADER_STAGE_COMPUTE_BIT;
         range.offset        = 0;
-        range.size          = 8; // uint32 width + uint32 height
+        range.size          = sizeof(Push_Constants);
 
         VkPipelineLayoutCreateInfo create_info { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
         create_info.setLayoutCount          = 1;
@@ -25,61 +111,67 @@ void Copy_To_Swapchain::create() {
         VK_CHECK(vkCreatePipelineLayout(vk.device, &create_info, nullptr, &pipeline_layout));
     }
 
+    if (use_push_descriptors)
+        update_template = layout.create_push_update_template(VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, "copy_to_swapchain_update_template");
+    else
+        update_template = layout.create_update_template(set_layout, "copy_to_swapchain_update_template");
+
+    // Linear sampler upscales the image rendered at lower resolution. At full resolution
+    // the texel centers are sampled and the result is the same as with point sampling.
+    {
+        VkSamplerCreateInfo create_info { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+        create_info.magFilter       = VK_FILTER_LINEAR;
+        create_info.minFilter       = VK_FILTER_LINEAR;
+        create_info.addressModeU    = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        create_info.addressModeV    = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        create_info.addressModeW    = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        VK_CHECK(vkCreateSampler(vk.device, &create_info, nullptr, &linear_sampler));
+        vk_set_debug_name(linear_sampler, "linear_sampler");
+    }
+
     // pipeline
     {
-        VkShaderModule copy_shader = vk_load_spirv("spirv/copy_to_swapchain.comp.spv");
+        VkShaderModule copy_shader = load_shader("copy_to_swapchain.comp.glsl");
 
-        VkPipelineShaderStageCreateInfo compute_stage { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
-        compute_stage.stage    = VK_SHADER_STAGE_COMPUTE_BIT;
-        compute_stage.module   = copy_shader;
-        compute_stage.pName    = "main";
+        // Workgroup size is defined by specialization constants 0 and 1.
+        auto create_pipeline = [this, copy_shader](Workgroup_Size size) {
+            Specialization_Constants specialization_constants;
+            specialization_constants
+                .uint32(0, size.x)
+                .uint32(1, size.y);
+            return vk_create_compute_pipeline(pipeline_layout, copy_shader, specialization_constants.get_info(), "copy_to_swapchain_pipeline");
+        };
 
-        VkComputePipelineCreateInfo create_info{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
-        create_info.stage = compute_stage;
-        create_info.layout = pipeline_layout;
-        VK_CHECK(vkCreateComputePipelines(vk.device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline));
+        if (tune_workgroup_size)
+            workgroup_size = benchmark_workgroup_sizes(*this, create_pipeline);
+        else
+            workgroup_size = select_workgroup_size_2d("copy_to_swapchain", false, nullptr, nullptr);
 
+        pipeline = create_pipeline(workgroup_size);
         vkDestroyShaderModule(vk.device, copy_shader, nullptr);
     }
-
-    // point sampler
-    {
-        VkSamplerCreateInfo create_info { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
-        VK_CHECK(vkCreateSampler(vk.device, &create_info, nullptr, &point_sampler));
-        vk_set_debug_name(point_sampler, "point_sampler");
-    }
 }
 
 void Copy_To_Swapchain::destroy() {
     vkDestroyDescriptorSetLayout(vk.device, set_layout, nullptr);
+    vkDestroyDescriptorUpdateTemplate(vk.device, update_template, nullptr);
     vkDestroyPipelineLayout(vk.device, pipeline_layout, nullptr);
     vkDestroyPipeline(vk.device, pipeline, nullptr);
-    vkDestroySampler(vk.device, point_sampler, nullptr);
-    sets.clear();
+    vkDestroySampler(vk.device, linear_sampler, nullptr);
 }
 
 void Copy_To_Swapchain::update_resolution_dependent_descriptors(VkImageView output_image_view) {
-    if (sets.size() < vk.swapchain_info.images.size())
-    {
-        size_t n = vk.swapchain_info.images.size() - sets.size();
-        for (size_t i = 0; i < n; i++)
-        {
-            VkDescriptorSetAllocateInfo alloc_info { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
-            alloc_info.descriptorPool     = vk.descriptor_pool;
-            alloc_info.descriptorSetCount = 1;
-            alloc_info.pSetLayouts        = &set_layout;
-
-            VkDescriptorSet set;
-            VK_CHECK(vkAllocateDescriptorSets(vk.device, &alloc_info, &set));
-            sets.push_back(set);
-
-            Descriptor_Writes(set).sampler(0, point_sampler);
-        }
-    }
+    this->output_image_view = output_image_view;
+}
 
-    for (size_t i = 0; i < vk.swapchain_info.images.size(); i++) {
-        Descriptor_Writes(sets[i])
-            .sampled_image(1, output_image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-            .storage_image(2, vk.swapchain_info.image_views[i]);
+// Without push descriptors the set is allocated from the per-frame allocator.
+void Copy_To_Swapchain::bind_descriptors(VkCommandBuffer command_buffer, uint32_t swapchain_image_index) {
+    Descriptor_Template_Data data = get_descriptor_data(linear_sampler, output_image_view, vk.swapchain_info.image_views[swapchain_image_index]);
+    if (use_push_descriptors) {
+        vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, update_template, pipeline_layout, 0, data.infos);
+    } else {
+        VkDescriptorSet set = vk.frame_descriptor_allocator->allocate(set_layout);
+        vkUpdateDescriptorSetWithTemplate(vk.device, set, update_template, data.infos);
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &set, 0, nullptr);
     }
 }
@@ -1,15 +1,34 @@
 #pragma once
 
+#include "compute_tuning.h"
+#include "utils.h"
 #include "vk.h"
 
+// Filter that upscales the image rendered at lower resolution.
+enum class Upscale_Filter : uint32_t {
+    bilinear,
+    edge_adaptive // EASU-like directional Lanczos2 filter
+};
+
 struct Copy_To_Swapchain {
-    VkDescriptorSetLayout           set_layout;
+    struct Push_Constants {
+        uint32_t        viewport_size[2];
+        float           src_scale[2]; // size of the rendered area relative to the output image size
+        Upscale_Filter  upscale_filter;
+        float           sharpness; // contrast adaptive sharpening in [0, 1], 0 disables it
+    };
+
+    VkDescriptorSetLayout           set_layout; // push descriptor layout if use_push_descriptors is set
+    VkDescriptorUpdateTemplate      update_template;
     VkPipelineLayout                pipeline_layout;
     VkPipeline                      pipeline;
-    VkSampler                       point_sampler;
-    std::vector<VkDescriptorSet>    sets; // per swapchain image
+    VkSampler                       linear_sampler;
+    VkImageView                     output_image_view;
+    Workgroup_Size                  workgroup_size;
+    bool                            use_push_descriptors;
 
-    void create();
+    void create(bool tune_workgroup_size, Descriptor_Backend descriptor_backend);
     void destroy();
     void update_resolution_dependent_descriptors(VkImageView output_image_view);
+    void bind_descriptors(VkCommandBuffer command_buffer, uint32_t swapchain_image_index);
 };
@@ -0,0 +1,71 @@
+#include "common.h"
+#include "cpu_profiler.h"
+
+CPU_Profiler cpu_profiler;
+
+static thread_local CPU_Thread_Events* thread_events = nullptr;
+
+CPU_Thread_Events* CPU_Profiler::get_thread_events() {
+    if (thread_events == nullptr) {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        threads.push_back(std::make_unique<CPU_Thread_Events>());
+        thread_events = threads.back().get();
+
+        thread_events->thread_index = (uint32_t)threads.size();
+        thread_events->thread_name = "thread " + std::to_string(thread_events->thread_index);
+        thread_events->events = std::make_unique<CPU_Scope_Event[]>(max_events_per_thread);
+        thread_events->event_count = 0;
+        thread_events->generation = 0;
+        thread_events->dropped_event_count = 0;
+    }
+    return thread_events;
+}
+
+void CPU_Profiler::set_thread_name(const char* name) {
+    CPU_Thread_Events* thread = get_thread_events();
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    thread->thread_name = name;
+}
+
+void CPU_Profiler::add_event(const char* name, uint64_t start_ticks, uint64_t end_ticks) {
+    CPU_Thread_Events* thread = get_thread_events();
+
+    // The buffer is reset by its owner on the first event of a new capture.
+    const uint32_t generation = capture_generation.load(std::memory_order_acquire);
+    if (thread->generation.load(std::memory_order_relaxed) != generation) {
+        thread->event_count.store(0, std::memory_order_relaxed);
+        thread->dropped_event_count.store(0, std::memory_order_relaxed);
+        thread->generation.store(generation, std::memory_order_release);
+    }
+
+    const uint32_t index = thread->event_count.load(std::memory_order_relaxed);
+    if (index == max_events_per_thread) {
+        thread->dropped_event_count.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    thread->events[index] = CPU_Scope_Event{name, start_ticks, end_ticks};
+    thread->event_count.store(index + 1, std::memory_order_release);
+}
+
+void CPU_Profiler::begin_capture() {
+    capture_generation.fetch_add(1, std::memory_order_acq_rel);
+    capturing.store(true, std::memory_order_relaxed);
+}
+
+void CPU_Profiler::end_capture() {
+    capturing.store(false, std::memory_order_relaxed);
+}
+
+std::vector<const CPU_Thread_Events*> CPU_Profiler::get_threads() {
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    std::vector<const CPU_Thread_Events*> result;
+    for (const auto& thread : threads)
+        result.push_back(thread.get());
+    return result;
+}
+
+uint32_t CPU_Profiler::get_captured_event_count(const CPU_Thread_Events& thread) const {
+    if (thread.generation.load(std::memory_order_acquire) != capture_generation.load(std::memory_order_relaxed))
+        return 0;
+    return thread.event_count.load(std::memory_order_acquire);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+// Invariant TSC, increments at the base CPU frequency. Trace_Capture derives the frequency.
+inline uint64_t read_cpu_ticks() {
+    return __rdtsc();
+}
+
+struct CPU_Scope_Event {
+    const char* name; // string literal
+    uint64_t    start_ticks;
+    uint64_t    end_ticks;
+};
+
+// Events of one thread. Only the owner thread writes the events, a reader sees the events
+// published by event_count, so recording does not take locks.
+struct CPU_Thread_Events {
+    std::string                         thread_name;
+    uint32_t                            thread_index;
+    std::unique_ptr<CPU_Scope_Event[]>  events;         // CPU_Profiler::max_events_per_thread
+    std::atomic<uint32_t>               event_count;
+    std::atomic<uint32_t>               generation;     // capture the events belong to
+    std::atomic<uint32_t>               dropped_event_count;
+};
+
+// Scoped CPU timing. Events are recorded only while a capture is active, otherwise a scope
+// costs one relaxed atomic load.
+class CPU_Profiler {
+public:
+    static constexpr uint32_t max_events_per_thread = 64 * 1024;
+
+    // Name shown in the trace for the calling thread.
+    void set_thread_name(const char* name);
+
+    bool is_capturing() const {
+        return capturing.load(std::memory_order_relaxed);
+    }
+    void add_event(const char* name, uint64_t start_ticks, uint64_t end_ticks);
+
+    void begin_capture();
+    void end_capture();
+
+    // Threads that recorded events. Should be called after end_capture, the returned objects
+    // stay valid until the profiler is destroyed.
+    std::vector<const CPU_Thread_Events*> get_threads();
+
+    // Number of events recorded by the thread in the last capture.
+    uint32_t get_captured_event_count(const CPU_Thread_Events& thread) const;
+
+private:
+    CPU_Thread_Events* get_thread_events();
+
+private:
+    std::atomic<bool>                               capturing = false;
+    std::atomic<uint32_t>                           capture_generation = 0;
+    std::mutex                                      threads_mutex; // taken only when a thread is registered
+    std::vector<std::unique_ptr<CPU_Thread_Events>> threads;
+};
+
+extern CPU_Profiler cpu_profiler;
+
+struct CPU_Time_Scope {
+    CPU_Time_Scope(const char* name) {
+        this->name = name;
+        start_ticks = cpu_profiler.is_capturing() ? read_cpu_ticks() : 0;
+    }
+    ~CPU_Time_Scope() {
+        if (start_ticks != 0)
+            cpu_profiler.add_event(name, start_ticks, read_cpu_ticks());
+    }
+
+private:
+    const char* name;
+    uint64_t    start_ticks;
+};
+
+#define CPU_TIME_SCOPE_CONCAT2(a, b) a##b
+#define CPU_TIME_SCOPE_CONCAT(a, b) CPU_TIME_SCOPE_CONCAT2(a, b)
+#define CPU_TIME_SCOPE(name) CPU_Time_Scope CPU_TIME_SCOPE_CONCAT(cpu_time_scope, __LINE__)(name)
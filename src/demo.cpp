@@ -1,7 +1,11 @@
 #include "common.h"
+#include "cpu_profiler.h"
 #include "demo.h"
+#include "descriptor_benchmark.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "platform.h"
+#include "shader_manager.h"
 #include "vk.h"
 #include "utils.h"
 
@@ -11,18 +15,36 @@
 #include "imgui/impl/imgui_impl_vulkan.h"
 #include "imgui/impl/imgui_impl_glfw.h"
 
+#include <algorithm>
 #include <cinttypes>
 #include <chrono>
+#include <limits>
+#include <thread>
 
 namespace {
 struct Uniform_Buffer {
-    Matrix4x4   model_view_proj;
-    Matrix4x4   model_view;
+    Matrix4x4   view_proj;
+    Matrix4x4   view;
+    Matrix4x4   model;
 };
+
+// Instance counts selectable in the UI and measured by the instancing benchmark.
+const uint32_t instance_count_steps[] = { 1, 10, 100, 1'000, 10'000, 100'000, 1'000'000 };
 }
 
-void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
-    vk_initialize(window, enable_validation_layers);
+void Vk_Demo::initialize(GLFWwindow* window, const Command_Line_Options& options) {
+    cpu_profiler.set_thread_name("main");
+
+    Depth_Buffer_Policy depth_policy;
+    depth_policy.stencil = false;
+    depth_policy.transient = options.transient_depth;
+    vk_initialize(window, options.enable_validation_layers, depth_policy);
+    initialize_shader_manager(options.compile_shaders, options.shader_dir);
+    trace_capture.initialize();
+
+    shader_hot_reload = options.shader_hot_reload;
+    if (shader_hot_reload)
+        shader_watcher.initialize(options.shader_dir);
 
     // Device properties.
     {
@@ -37,12 +59,31 @@ void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
         );
     }
 
+    if (options.benchmark_descriptors)
+        run_descriptor_bind_benchmark();
+
     // Geometry buffers.
     {
         Mesh mesh = load_obj_mesh(get_resource_path("model/mesh.obj"), 1.25f);
 
         model_vertex_count = static_cast<uint32_t>(mesh.vertices.size());
         model_index_count = static_cast<uint32_t>(mesh.indices.size());
+
+        // Bounding sphere around the center of the bounding box.
+        {
+            Vector3 min_point(std::numeric_limits<float>::max());
+            Vector3 max_point(-std::numeric_limits<float>::max());
+            for (const Vertex& v : mesh.vertices) {
+                for (int i = 0; i < 3; i++) {
+                    min_point[i] = std::min(min_point[i], v.pos[i]);
+                    max_point[i] = std::max(max_point[i], v.pos[i]);
+                }
+            }
+            model_bounding_sphere_center = (min_point + max_point) * 0.5f;
+            model_bounding_sphere_radius = 0.f;
+            for (const Vertex& v : mesh.vertices)
+                model_bounding_sphere_radius = std::max(model_bounding_sphere_radius, (v.pos - model_bounding_sphere_center).length());
+        }
         {
             const VkDeviceSize size = mesh.vertices.size() * sizeof(mesh.vertices[0]);
             vertex_buffer = vk_create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, "vertex_buffer");
@@ -94,17 +135,17 @@ void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
         vk_set_debug_name(sampler, "diffuse_texture_sampler");
     }
 
-    // UI render pass.
+    // UI render pass. UI is drawn on top of the swapchain image after the output image was transferred there.
     {
         VkAttachmentDescription attachments[1] = {};
-        attachments[0].format           = VK_FORMAT_R16G16B16A16_SFLOAT;
+        attachments[0].format           = vk.surface_format.format;
         attachments[0].samples          = VK_SAMPLE_COUNT_1_BIT;
         attachments[0].loadOp           = VK_ATTACHMENT_LOAD_OP_LOAD;
         attachments[0].storeOp          = VK_ATTACHMENT_STORE_OP_STORE;
         attachments[0].stencilLoadOp    = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         attachments[0].stencilStoreOp   = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         attachments[0].initialLayout    = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-        attachments[0].finalLayout      = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        attachments[0].finalLayout      = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
         VkAttachmentReference color_attachment_ref;
         color_attachment_ref.attachment = 0;
@@ -125,25 +166,42 @@ void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
         vk_set_debug_name(ui_render_pass, "ui_render_pass");
     }
 
-    uniform_buffer = vk_create_host_visible_buffer(static_cast<VkDeviceSize>(sizeof(Uniform_Buffer)),
-        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &mapped_uniform_buffer, "uniform_buffer");
+    // Check if output image can be blitted to swapchain image.
+    {
+        VkFormatProperties output_format_props;
+        vkGetPhysicalDeviceFormatProperties(vk.physical_device, VK_FORMAT_R16G16B16A16_SFLOAT, &output_format_props);
+
+        VkFormatProperties swapchain_format_props;
+        vkGetPhysicalDeviceFormatProperties(vk.physical_device, vk.surface_format.format, &swapchain_format_props);
+
+        blit_supported = (output_format_props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT) != 0 &&
+                         (swapchain_format_props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT) != 0;
+    }
+
+    uniform_allocator.create(64 * 1024, (uint32_t)std::size(vk.frame_fence), "uniform_buffer");
 
     descriptor_set_layout = Descriptor_Set_Layout()
-        .uniform_buffer (0, VK_SHADER_STAGE_VERTEX_BIT)
-        .sampled_image  (1, VK_SHADER_STAGE_FRAGMENT_BIT)
-        .sampler        (2, VK_SHADER_STAGE_FRAGMENT_BIT)
+        .uniform_buffer_dynamic(0, VK_SHADER_STAGE_VERTEX_BIT)
+        .sampler        (1, VK_SHADER_STAGE_FRAGMENT_BIT)
+        .storage_buffer (2, VK_SHADER_STAGE_VERTEX_BIT)
         .create         ("set_layout");
 
+    // Textures are accessed through the bindless table (set 1).
+    texture_table.create(4096);
+    texture_index = texture_table.add_texture(texture.view);
+
     // Pipeline layout.
     {
-        VkPushConstantRange push_constant_range; // show_texture_lods value
+        VkPushConstantRange push_constant_range; // texture index
         push_constant_range.stageFlags  = VK_SHADER_STAGE_FRAGMENT_BIT;
         push_constant_range.offset      = 0;
         push_constant_range.size        = 4;
 
+        VkDescriptorSetLayout set_layouts[] = { descriptor_set_layout, texture_table.set_layout };
+
         VkPipelineLayoutCreateInfo create_info{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
-        create_info.setLayoutCount          = 1;
-        create_info.pSetLayouts             = &descriptor_set_layout;
+        create_info.setLayoutCount          = (uint32_t)std::size(set_layouts);
+        create_info.pSetLayouts             = set_layouts;
         create_info.pushConstantRangeCount  = 1;
         create_info.pPushConstantRanges     = &push_constant_range;
 
@@ -151,55 +209,80 @@ void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
         vk_set_debug_name(pipeline_layout, "pipeline_layout");
     }
 
-    // Render pass.
+    // Render passes.
     {
-        VkAttachmentDescription attachments[2] = {};
-        attachments[0].format           = VK_FORMAT_R16G16B16A16_SFLOAT;
-        attachments[0].samples          = VK_SAMPLE_COUNT_1_BIT;
-        attachments[0].loadOp           = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        attachments[0].storeOp          = VK_ATTACHMENT_STORE_OP_STORE;
-        attachments[0].stencilLoadOp    = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        attachments[0].stencilStoreOp   = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        attachments[0].initialLayout    = VK_IMAGE_LAYOUT_UNDEFINED;
-        attachments[0].finalLayout      = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-        attachments[1].format           = vk.depth_info.format;
-        attachments[1].samples          = VK_SAMPLE_COUNT_1_BIT;
-        attachments[1].loadOp           = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        attachments[1].storeOp          = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        attachments[1].stencilLoadOp    = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        attachments[1].stencilStoreOp   = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        attachments[1].initialLayout    = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-        attachments[1].finalLayout      = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentReference color_attachment_ref;
-        color_attachment_ref.attachment = 0;
-        color_attachment_ref.layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-        VkAttachmentReference depth_attachment_ref;
-        depth_attachment_ref.attachment = 1;
-        depth_attachment_ref.layout     = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-        VkSubpassDescription subpass{};
-        subpass.pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.colorAttachmentCount    = 1;
-        subpass.pColorAttachments       = &color_attachment_ref;
-        subpass.pDepthStencilAttachment = &depth_attachment_ref;
-
-        VkRenderPassCreateInfo create_info{ VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
-        create_info.attachmentCount = (uint32_t)std::size(attachments);
-        create_info.pAttachments = attachments;
-        create_info.subpassCount = 1;
-        create_info.pSubpasses = &subpass;
-
-        VK_CHECK(vkCreateRenderPass(vk.device, &create_info, nullptr, &render_pass));
-        vk_set_debug_name(render_pass, "color_depth_render_pass");
+        // Creates color-depth render pass. The color attachment stays in COLOR_ATTACHMENT_OPTIMAL layout,
+        // the following passes transition it to the layout they need. Depth is stored for Hi-Z pyramid
+        // unless it is transient. Render passes that load attachments continue rendering of the render
+        // pass that clears them.
+        auto create_render_pass = [](VkFormat color_format, VkAttachmentLoadOp load_op, const char* name) {
+            VkAttachmentDescription attachments[2] = {};
+            attachments[0].format           = color_format;
+            attachments[0].samples          = VK_SAMPLE_COUNT_1_BIT;
+            attachments[0].loadOp           = load_op;
+            attachments[0].storeOp          = VK_ATTACHMENT_STORE_OP_STORE;
+            attachments[0].stencilLoadOp    = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            attachments[0].stencilStoreOp   = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachments[0].initialLayout    = (load_op == VK_ATTACHMENT_LOAD_OP_LOAD) ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+            attachments[0].finalLayout      = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+            attachments[1].format           = vk.depth_info.format;
+            attachments[1].samples          = VK_SAMPLE_COUNT_1_BIT;
+            attachments[1].loadOp           = load_op;
+            attachments[1].storeOp          = vk.depth_info.transient ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+            attachments[1].stencilLoadOp    = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            attachments[1].stencilStoreOp   = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachments[1].initialLayout    = (load_op == VK_ATTACHMENT_LOAD_OP_LOAD) ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+            attachments[1].finalLayout      = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+            VkAttachmentReference color_attachment_ref;
+            color_attachment_ref.attachment = 0;
+            color_attachment_ref.layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+            VkAttachmentReference depth_attachment_ref;
+            depth_attachment_ref.attachment = 1;
+            depth_attachment_ref.layout     = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+            VkSubpassDescription subpass{};
+            subpass.pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
+            subpass.colorAttachmentCount    = 1;
+            subpass.pColorAttachments       = &color_attachment_ref;
+            subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+            // The implicit external dependency starts at TOP_OF_PIPE and does not chain with the image
+            // acquire semaphore wait at COLOR_ATTACHMENT_OUTPUT, so the swapchain image layout transition
+            // could happen before the image is acquired. The dependency also orders attachment writes
+            // with the writes of the previous pass or frame that used the same attachments.
+            VkSubpassDependency dependency{};
+            dependency.srcSubpass           = VK_SUBPASS_EXTERNAL;
+            dependency.dstSubpass           = 0;
+            dependency.srcStageMask         = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            dependency.dstStageMask         = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+            dependency.srcAccessMask        = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            dependency.dstAccessMask        = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+            VkRenderPassCreateInfo create_info{ VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+            create_info.attachmentCount = (uint32_t)std::size(attachments);
+            create_info.pAttachments = attachments;
+            create_info.subpassCount = 1;
+            create_info.pSubpasses = &subpass;
+            create_info.dependencyCount = 1;
+            create_info.pDependencies = &dependency;
+
+            VkRenderPass render_pass;
+            VK_CHECK(vkCreateRenderPass(vk.device, &create_info, nullptr, &render_pass));
+            vk_set_debug_name(render_pass, name);
+            return render_pass;
+        };
+        render_pass = create_render_pass(VK_FORMAT_R16G16B16A16_SFLOAT, VK_ATTACHMENT_LOAD_OP_CLEAR, "color_depth_render_pass");
+        render_pass_load = create_render_pass(VK_FORMAT_R16G16B16A16_SFLOAT, VK_ATTACHMENT_LOAD_OP_LOAD, "color_depth_render_pass_load");
+        direct_render_pass = create_render_pass(vk.surface_format.format, VK_ATTACHMENT_LOAD_OP_CLEAR, "swapchain_depth_render_pass");
+        direct_render_pass_load = create_render_pass(vk.surface_format.format, VK_ATTACHMENT_LOAD_OP_LOAD, "swapchain_depth_render_pass_load");
     }
 
-    // Pipeline.
+    // Pipelines. Main pipelines are compiled in the background, cheap fallback pipelines are used until they are ready.
     {
-        VkShaderModule vertex_shader = vk_load_spirv("spirv/mesh.vert.spv");
-        VkShaderModule fragment_shader = vk_load_spirv("spirv/mesh.frag.spv");
+        pipeline_compiler.initialize(std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u));
 
         Vk_Graphics_Pipeline_State state = get_default_graphics_pipeline_state();
 
@@ -225,28 +308,86 @@ void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
         state.vertex_attributes[2].format = VK_FORMAT_R32G32_SFLOAT;
         state.vertex_attributes[2].offset = 24;
         state.vertex_attribute_count = 3;
+        mesh_pipeline_state = state;
 
-        pipeline = vk_create_graphics_pipeline(state, pipeline_layout, render_pass, vertex_shader, fragment_shader);
+        pipeline_compiler.compile_graphics_pipeline(&pipeline, "mesh_pipeline",
+            state, pipeline_layout, render_pass,
+            load_shader("mesh.vert.glsl"), load_shader("mesh.frag.glsl"));
+
+        pipeline_compiler.compile_graphics_pipeline(&direct_pipeline, "mesh_direct_pipeline",
+            state, pipeline_layout, direct_render_pass,
+            load_shader("mesh.vert.glsl"), load_shader("mesh.frag.glsl"));
+
+        // Depth-only pipeline reads only vertex position and does not write color.
+        depth_only_pipeline_state = state;
+        depth_only_pipeline_state.vertex_attribute_count = 1;
+        depth_only_pipeline_state.attachment_blend_state[0].colorWriteMask = 0;
+
+        depth_equal_pipeline_state = state;
+        depth_equal_pipeline_state.depth_stencil_state.depthWriteEnable = VK_FALSE;
+        depth_equal_pipeline_state.depth_stencil_state.depthCompareOp = VK_COMPARE_OP_EQUAL;
+
+        pipeline_compiler.compile_graphics_pipeline(&depth_only_pipeline, "depth_only_pipeline",
+            depth_only_pipeline_state, pipeline_layout, render_pass,
+            load_shader("depth_prepass.vert.glsl"), VK_NULL_HANDLE);
+
+        pipeline_compiler.compile_graphics_pipeline(&depth_equal_pipeline, "mesh_depth_equal_pipeline",
+            depth_equal_pipeline_state, pipeline_layout, render_pass,
+            load_shader("mesh.vert.glsl"), load_shader("mesh.frag.glsl"));
+
+        pipeline_compiler.compile_graphics_pipeline(&direct_depth_only_pipeline, "direct_depth_only_pipeline",
+            depth_only_pipeline_state, pipeline_layout, direct_render_pass,
+            load_shader("depth_prepass.vert.glsl"), VK_NULL_HANDLE);
+
+        pipeline_compiler.compile_graphics_pipeline(&direct_depth_equal_pipeline, "mesh_direct_depth_equal_pipeline",
+            depth_equal_pipeline_state, pipeline_layout, direct_render_pass,
+            load_shader("mesh.vert.glsl"), load_shader("mesh.frag.glsl"));
+
+        VkShaderModule vertex_shader = load_shader("mesh.vert.glsl");
+        VkShaderModule fallback_fragment_shader = load_shader("mesh_fallback.frag.glsl");
+
+        fallback_pipeline = vk_create_graphics_pipeline(state, pipeline_layout, render_pass, vertex_shader, fallback_fragment_shader);
+        direct_fallback_pipeline = vk_create_graphics_pipeline(state, pipeline_layout, direct_render_pass, vertex_shader, fallback_fragment_shader);
+        pipeline.fallback = fallback_pipeline;
+        direct_pipeline.fallback = direct_fallback_pipeline;
 
         vkDestroyShaderModule(vk.device, vertex_shader, nullptr);
-        vkDestroyShaderModule(vk.device, fragment_shader, nullptr);
+        vkDestroyShaderModule(vk.device, fallback_fragment_shader, nullptr);
     }
 
-    // Descriptor sets.
-    {
-        VkDescriptorSetAllocateInfo desc { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
-        desc.descriptorPool     = vk.descriptor_pool;
-        desc.descriptorSetCount = 1;
-        desc.pSetLayouts        = &descriptor_set_layout;
-        VK_CHECK(vkAllocateDescriptorSets(vk.device, &desc, &descriptor_set));
-
-        Descriptor_Writes(descriptor_set)
-            .uniform_buffer (0, uniform_buffer.handle, 0, sizeof(Uniform_Buffer))
-            .sampled_image  (1, texture.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-            .sampler        (2, sampler);
+    // Descriptor set is allocated by create_instance_buffer.
+    // GPU culling always binds Hi-Z pyramid, so both are created together.
+    gpu_culling_supported = vk.multi_draw_indirect_supported && vk.storage_image_array_indexing_supported;
+    if (gpu_culling_supported) {
+        instance_culling.create(uniform_allocator);
+        hi_z.create();
+    }
+    create_instance_buffer(1);
+
+    if (vk.pipeline_statistics_supported) {
+        VkQueryPoolCreateInfo create_info { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        create_info.queryType           = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        create_info.queryCount          = 1;
+        create_info.pipelineStatistics  = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+                                          VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+        for (VkQueryPool& query_pool : pipeline_statistics_query_pools) {
+            VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &query_pool));
+            vk_set_debug_name(query_pool, "pipeline_statistics_query_pool");
+        }
+        vk_execute(vk.command_pools[0], vk.queue, [this](VkCommandBuffer command_buffer) {
+            for (VkQueryPool query_pool : pipeline_statistics_query_pools)
+                vkCmdResetQueryPool(command_buffer, query_pool, 0, 1);
+        });
     }
 
-    copy_to_swapchain.create();
+    copy_to_swapchain.create(options.tune_workgroup_sizes, options.descriptor_backend);
+    dynamic_resolution.fixed_scale = options.render_scale;
+    upscale_filter = options.upscale_filter;
+    sharpness = options.sharpness;
+    frame_pacer.target_fps = options.target_fps;
+    render_on_demand = options.render_on_demand;
+    request_redraw();
     restore_resolution_dependent_resources();
 
     // ImGui setup.
@@ -254,13 +395,22 @@ void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
         ImGui::CreateContext();
         ImGui_ImplGlfw_InitForVulkan(window, true);
 
+        // ImGui allocates the font descriptor set from the pool it is given.
+        VkDescriptorPoolSize pool_size { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 };
+        VkDescriptorPoolCreateInfo pool_create_info { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+        pool_create_info.maxSets        = 1;
+        pool_create_info.poolSizeCount  = 1;
+        pool_create_info.pPoolSizes     = &pool_size;
+        VK_CHECK(vkCreateDescriptorPool(vk.device, &pool_create_info, nullptr, &imgui_descriptor_pool));
+        vk_set_debug_name(imgui_descriptor_pool, "imgui_descriptor_pool");
+
         ImGui_ImplVulkan_InitInfo init_info{};
         init_info.Instance          = vk.instance;
         init_info.PhysicalDevice    = vk.physical_device;
         init_info.Device            = vk.device;
         init_info.QueueFamily       = vk.queue_family_index;
         init_info.Queue             = vk.queue;
-        init_info.DescriptorPool    = vk.descriptor_pool;
+        init_info.DescriptorPool    = imgui_descriptor_pool;
 
         ImGui_ImplVulkan_Init(&init_info, ui_render_pass);
         ImGui::StyleColorsDark();
@@ -271,64 +421,118 @@ void Vk_Demo::initialize(GLFWwindow* window, bool enable_validation_layers) {
         ImGui_ImplVulkan_InvalidateFontUploadObjects();
     }
 
-    gpu_times.frame = time_keeper.allocate_time_interval();
-    gpu_times.draw = time_keeper.allocate_time_interval();
-    gpu_times.ui = time_keeper.allocate_time_interval();
-    gpu_times.compute_copy = time_keeper.allocate_time_interval();
-    time_keeper.initialize_time_intervals();
+    if (options.benchmark_instancing)
+        run_instancing_benchmark();
 }
 
 void Vk_Demo::shutdown() {
     VK_CHECK(vkDeviceWaitIdle(vk.device));
+    pipeline_compiler.shutdown();
 
     ImGui_ImplVulkan_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
+    vkDestroyDescriptorPool(vk.device, imgui_descriptor_pool, nullptr);
 
+    gpu_profiler.shutdown();
     vertex_buffer.destroy();
     index_buffer.destroy();
+    instance_buffer.destroy();
+    instance_staging_buffer.destroy();
+    if (gpu_culling_supported) {
+        instance_culling.destroy();
+        hi_z.destroy();
+    }
+    if (vk.pipeline_statistics_supported) {
+        for (VkQueryPool query_pool : pipeline_statistics_query_pools)
+            vkDestroyQueryPool(vk.device, query_pool, nullptr);
+    }
+    texture_table.destroy();
     texture.destroy();
     copy_to_swapchain.destroy();
     vkDestroySampler(vk.device, sampler, nullptr);
     vkDestroyRenderPass(vk.device, ui_render_pass, nullptr);
     release_resolution_dependent_resources();
-    uniform_buffer.destroy();
+    uniform_allocator.destroy();
     vkDestroyDescriptorSetLayout(vk.device, descriptor_set_layout, nullptr);
     vkDestroyPipelineLayout(vk.device, pipeline_layout, nullptr);
-    vkDestroyPipeline(vk.device, pipeline, nullptr);
+    pipeline.destroy();
+    direct_pipeline.destroy();
+    reloaded_pipeline.destroy();
+    reloaded_direct_pipeline.destroy();
+    depth_only_pipeline.destroy();
+    depth_equal_pipeline.destroy();
+    direct_depth_only_pipeline.destroy();
+    direct_depth_equal_pipeline.destroy();
+    reloaded_depth_only_pipeline.destroy();
+    reloaded_depth_equal_pipeline.destroy();
+    reloaded_direct_depth_only_pipeline.destroy();
+    reloaded_direct_depth_equal_pipeline.destroy();
+    reloaded_copy_pipeline.destroy();
+    reloaded_cull_pipeline.destroy();
+    reloaded_hi_z_pipeline.destroy();
+    if (shader_hot_reload)
+        shader_watcher.shutdown();
+    vkDestroyPipeline(vk.device, fallback_pipeline, nullptr);
+    vkDestroyPipeline(vk.device, direct_fallback_pipeline, nullptr);
     vkDestroyRenderPass(vk.device, render_pass, nullptr);
+    vkDestroyRenderPass(vk.device, render_pass_load, nullptr);
+    vkDestroyRenderPass(vk.device, direct_render_pass, nullptr);
+    vkDestroyRenderPass(vk.device, direct_render_pass_load, nullptr);
 
     vk_shutdown();
 }
 
+// The frames in flight still use the resources, they are destroyed when those frames are finished.
 void Vk_Demo::release_resolution_dependent_resources() {
-    vkDestroyFramebuffer(vk.device, ui_framebuffer, nullptr);
-    ui_framebuffer = VK_NULL_HANDLE;
+    for (VkFramebuffer ui_framebuffer : ui_framebuffers)
+        vk_destroy_deferred(ui_framebuffer);
+    ui_framebuffers.clear();
+
+    for (VkFramebuffer direct_framebuffer : direct_framebuffers)
+        vk_destroy_deferred(direct_framebuffer);
+    direct_framebuffers.clear();
 
-    vkDestroyFramebuffer(vk.device, framebuffer, nullptr);
+    vk_destroy_deferred(framebuffer);
     framebuffer = VK_NULL_HANDLE;
 
-    output_image.destroy();
+    vk_destroy_deferred(output_image);
+
+    if (gpu_culling_supported)
+        hi_z.release_resolution_dependent_resources();
 }
 
 void Vk_Demo::restore_resolution_dependent_resources() {
     // output image
     {
         output_image = vk_create_image(vk.surface_size.width, vk.surface_size.height, VK_FORMAT_R16G16B16A16_SFLOAT,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, "output_image");
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+            "output_image");
     }
 
-    // imgui framebuffer
-    {
+    // swapchain framebuffers
+    for (size_t i = 0; i < vk.swapchain_info.images.size(); i++) {
         VkFramebufferCreateInfo create_info { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
         create_info.renderPass      = ui_render_pass;
         create_info.attachmentCount = 1;
-        create_info.pAttachments    = &output_image.view;
+        create_info.pAttachments    = &vk.swapchain_info.image_views[i];
         create_info.width           = vk.surface_size.width;
         create_info.height          = vk.surface_size.height;
         create_info.layers          = 1;
 
+        VkFramebuffer ui_framebuffer;
         VK_CHECK(vkCreateFramebuffer(vk.device, &create_info, nullptr, &ui_framebuffer));
+        ui_framebuffers.push_back(ui_framebuffer);
+
+        VkImageView attachments[] = {vk.swapchain_info.image_views[i], vk.depth_info.image_view};
+        create_info.renderPass      = direct_render_pass;
+        create_info.attachmentCount = (uint32_t)std::size(attachments);
+        create_info.pAttachments    = attachments;
+
+        VkFramebuffer direct_framebuffer;
+        VK_CHECK(vkCreateFramebuffer(vk.device, &create_info, nullptr, &direct_framebuffer));
+        vk_set_debug_name(direct_framebuffer, "swapchain_depth_framebuffer");
+        direct_framebuffers.push_back(direct_framebuffer);
     }
     
     VkImageView attachments[] = {output_image.view, vk.depth_info.image_view};
@@ -344,10 +548,65 @@ void Vk_Demo::restore_resolution_dependent_resources() {
     vk_set_debug_name(framebuffer, "color_depth_framebuffer");
 
     copy_to_swapchain.update_resolution_dependent_descriptors(output_image.view);
+
+    if (gpu_culling_supported) {
+        hi_z.create_resolution_dependent_resources(vk.surface_size.width, vk.surface_size.height,
+            vk.depth_info.transient ? VK_NULL_HANDLE : vk.depth_info.image_view);
+        instance_culling.update_hi_z(hi_z.image.view, hi_z.point_sampler, hi_z.width, hi_z.height, hi_z.level_count);
+    }
+    scene_image_valid = false;
     last_frame_time = Clock::now();
 }
 
+Scene_State Vk_Demo::get_scene_state() const {
+    const bool direct = (output_path == Output_Path::direct);
+
+    Scene_State state;
+    memset(&state, 0, sizeof(state));
+    state.model_transform       = model_transform;
+    state.view_transform        = view_transform;
+    state.projection_transform  = projection_transform;
+    state.pipelines[0]          = direct ? direct_pipeline.get() : pipeline.get();
+    state.pipelines[1]          = direct ? direct_depth_only_pipeline.get() : depth_only_pipeline.get();
+    state.pipelines[2]          = direct ? direct_depth_equal_pipeline.get() : depth_equal_pipeline.get();
+    state.instance_count        = instance_count;
+    state.output_path           = output_path;
+    state.fixed_render_scale    = dynamic_resolution.fixed_scale;
+    state.dynamic_resolution    = dynamic_resolution.enabled;
+    state.gpu_culling           = gpu_culling;
+    state.occlusion_culling     = occlusion_culling;
+    state.depth_prepass         = depth_prepass;
+    return state;
+}
+
+void Vk_Demo::wait_for_next_frame() {
+    frame_pacer.wait_for_next_frame();
+}
+
 void Vk_Demo::run_frame() {
+    CPU_TIME_SCOPE("run_frame");
+    frame_pacer.input_polled();
+
+    if (idle.active) {
+        const double duration_s = elapsed_microseconds(idle.start_time) / 1e6;
+        idle.duration_s = float(duration_s);
+        idle.cpu_usage = duration_s > 0.0 ? float((platform::get_process_cpu_time_seconds() - idle.start_cpu_time) / duration_s) : 0.f;
+        idle.last_wakeups = idle.wakeups;
+        idle.active = false;
+    }
+    if (redraw_frame_count > 0)
+        redraw_frame_count--;
+    // Compiled pipelines are taken at the frame boundary and replace the fallbacks.
+    // Trace capture needs consecutive frames.
+    if (pipeline_compiler.has_pending_jobs() || trace_capture.is_active())
+        request_redraw();
+
+    if (shader_hot_reload)
+        update_shader_hot_reload();
+
+    // UI processes keyboard input, so the camera is latched after it.
+    do_imgui();
+
     Time current_time = Clock::now();
     if (animate) {
         double time_delta = std::chrono::duration_cast<std::chrono::microseconds>(current_time - last_frame_time).count() / 1e6;
@@ -359,49 +618,394 @@ void Vk_Demo::run_frame() {
     view_transform = look_at_transform(camera_pos, Vector3(0), Vector3(0, 1, 0));
 
     float aspect_ratio = (float)vk.surface_size.width / (float)vk.surface_size.height;
-    Matrix4x4 proj = perspective_transform_opengl_z01(radians(45.0f), aspect_ratio, 0.1f, 50.0f);
-    Matrix4x4 model_view = Matrix4x4::identity * view_transform * model_transform;
-    Matrix4x4 model_view_proj = proj * view_transform * model_transform;
-    static_cast<Uniform_Buffer*>(mapped_uniform_buffer)->model_view_proj = model_view_proj;
-    static_cast<Uniform_Buffer*>(mapped_uniform_buffer)->model_view = model_view;
-
-    Matrix3x4 camera_to_world_transform;
-    camera_to_world_transform.set_column(0, Vector3(view_transform.get_row(0)));
-    camera_to_world_transform.set_column(1, Vector3(view_transform.get_row(1)));
-    camera_to_world_transform.set_column(2, Vector3(view_transform.get_row(2)));
-    camera_to_world_transform.set_column(3, camera_pos);
+    projection_transform = perspective_transform_opengl_z01(radians(45.0f), aspect_ratio, 0.1f, 50.0f);
 
-    do_imgui();
-    draw_frame();
+    if (!draw_frame()) {
+        request_redraw();
+        return;
+    }
+    frame_pacer.frame_submitted();
+    trace_capture.frame_submitted();
+}
+
+bool Vk_Demo::needs_frame() const {
+    return !render_on_demand || animate || redraw_frame_count > 0;
+}
+
+void Vk_Demo::request_redraw() {
+    // UI needs a frame to handle the input and another one to show the result. GPU timings and
+    // culling stats are read back from the frames in flight, so a few more frames are rendered.
+    const uint32_t frames_after_change = 4;
+    redraw_frame_count = frames_after_change;
+}
+
+void Vk_Demo::wait_for_events() {
+    // The timeout allows to notice modified shaders without input events.
+    const double timeout_s = 0.25;
+
+    if (!idle.active) {
+        idle.active = true;
+        idle.start_time = Timestamp();
+        idle.start_cpu_time = platform::get_process_cpu_time_seconds();
+        idle.wakeups = 0;
+    }
+    glfwWaitEventsTimeout(timeout_s);
+    idle.wakeups++;
+
+    if (shader_hot_reload) {
+        std::vector<std::string> files = shader_watcher.get_modified_files();
+        if (!files.empty()) {
+            modified_shader_files.insert(modified_shader_files.end(), files.begin(), files.end());
+            request_redraw();
+        }
+    }
+}
+
+// Called at the frame boundary: the previous frame is submitted and the next one is not started yet.
+void Vk_Demo::update_shader_hot_reload() {
+    CPU_TIME_SCOPE("update_shader_hot_reload");
+    std::vector<std::string> modified_files = shader_watcher.get_modified_files();
+    modified_files.insert(modified_files.end(), modified_shader_files.begin(), modified_shader_files.end());
+    modified_shader_files.clear();
+    if (!modified_files.empty()) {
+        auto depends_on_modified_files = [&modified_files](const char* shader_file) {
+            std::vector<std::string> dependencies;
+            try {
+                dependencies = get_shader_dependencies(shader_file);
+            } catch (const std::runtime_error&) {
+                return false; // include is missing, the next file change triggers another attempt
+            }
+            for (const std::string& file : modified_files) {
+                if (std::find(dependencies.begin(), dependencies.end(), file) != dependencies.end())
+                    return true;
+            }
+            return false;
+        };
+
+        if (depends_on_modified_files("mesh.vert.glsl") || depends_on_modified_files("mesh.frag.glsl")) {
+            pipeline_compiler.reload_graphics_pipeline(&reloaded_pipeline, "mesh_pipeline",
+                mesh_pipeline_state, pipeline_layout, render_pass, "mesh.vert.glsl", "mesh.frag.glsl");
+            pipeline_compiler.reload_graphics_pipeline(&reloaded_direct_pipeline, "mesh_direct_pipeline",
+                mesh_pipeline_state, pipeline_layout, direct_render_pass, "mesh.vert.glsl", "mesh.frag.glsl");
+            pipeline_compiler.reload_graphics_pipeline(&reloaded_depth_equal_pipeline, "mesh_depth_equal_pipeline",
+                depth_equal_pipeline_state, pipeline_layout, render_pass, "mesh.vert.glsl", "mesh.frag.glsl");
+            pipeline_compiler.reload_graphics_pipeline(&reloaded_direct_depth_equal_pipeline, "mesh_direct_depth_equal_pipeline",
+                depth_equal_pipeline_state, pipeline_layout, direct_render_pass, "mesh.vert.glsl", "mesh.frag.glsl");
+        }
+        if (depends_on_modified_files("depth_prepass.vert.glsl")) {
+            pipeline_compiler.reload_graphics_pipeline(&reloaded_depth_only_pipeline, "depth_only_pipeline",
+                depth_only_pipeline_state, pipeline_layout, render_pass, "depth_prepass.vert.glsl", nullptr);
+            pipeline_compiler.reload_graphics_pipeline(&reloaded_direct_depth_only_pipeline, "direct_depth_only_pipeline",
+                depth_only_pipeline_state, pipeline_layout, direct_render_pass, "depth_prepass.vert.glsl", nullptr);
+        }
+        if (depends_on_modified_files("copy_to_swapchain.comp.glsl")) {
+            Specialization_Constants specialization_constants;
+            specialization_constants
+                .uint32(0, copy_to_swapchain.workgroup_size.x)
+                .uint32(1, copy_to_swapchain.workgroup_size.y);
+            pipeline_compiler.reload_compute_pipeline(&reloaded_copy_pipeline, "copy_to_swapchain_pipeline",
+                copy_to_swapchain.pipeline_layout, "copy_to_swapchain.comp.glsl", specialization_constants);
+        }
+        if (gpu_culling_supported && depends_on_modified_files("cull_instances.comp.glsl")) {
+            pipeline_compiler.reload_compute_pipeline(&reloaded_cull_pipeline, "cull_instances_pipeline",
+                instance_culling.pipeline_layout, "cull_instances.comp.glsl", Specialization_Constants());
+        }
+        if (gpu_culling_supported && depends_on_modified_files("hi_z_downsample.comp.glsl")) {
+            pipeline_compiler.reload_compute_pipeline(&reloaded_hi_z_pipeline, "hi_z_downsample_pipeline",
+                hi_z.pipeline_layout, "hi_z_downsample.comp.glsl", Specialization_Constants());
+        }
+    }
+
+    // The initial compilation of the mesh pipelines might be still in progress. In that case
+    // the reloaded pipeline waits, otherwise it would be overwritten by the initial one.
+    auto swap_pipeline = [](Async_Pipeline& pipeline, Reloaded_Pipeline& reloaded_pipeline) {
+        if (pipeline.is_ready()) {
+            VkPipeline new_pipeline = reloaded_pipeline.take();
+            if (new_pipeline != VK_NULL_HANDLE)
+                vk_destroy_deferred(pipeline.handle.exchange(new_pipeline, std::memory_order_acq_rel));
+        }
+    };
+    swap_pipeline(pipeline, reloaded_pipeline);
+    swap_pipeline(direct_pipeline, reloaded_direct_pipeline);
+    swap_pipeline(depth_only_pipeline, reloaded_depth_only_pipeline);
+    swap_pipeline(depth_equal_pipeline, reloaded_depth_equal_pipeline);
+    swap_pipeline(direct_depth_only_pipeline, reloaded_direct_depth_only_pipeline);
+    swap_pipeline(direct_depth_equal_pipeline, reloaded_direct_depth_equal_pipeline);
+
+    VkPipeline new_copy_pipeline = reloaded_copy_pipeline.take();
+    if (new_copy_pipeline != VK_NULL_HANDLE) {
+        vk_destroy_deferred(copy_to_swapchain.pipeline);
+        copy_to_swapchain.pipeline = new_copy_pipeline;
+    }
+
+    VkPipeline new_cull_pipeline = reloaded_cull_pipeline.take();
+    if (new_cull_pipeline != VK_NULL_HANDLE) {
+        vk_destroy_deferred(instance_culling.pipeline);
+        instance_culling.pipeline = new_cull_pipeline;
+    }
+
+    VkPipeline new_hi_z_pipeline = reloaded_hi_z_pipeline.take();
+    if (new_hi_z_pipeline != VK_NULL_HANDLE) {
+        vk_destroy_deferred(hi_z.pipeline);
+        hi_z.pipeline = new_hi_z_pipeline;
+    }
+}
+
+// Instances are placed on a grid in xz plane, the first instance is at the origin and the grid
+// extends away from the camera. Transforms are uploaded once, animation is applied by the model
+// transform from the uniform buffer.
+void Vk_Demo::create_instance_buffer(uint32_t count) {
+    // The descriptor set that references the instance buffer can't be updated while in use,
+    // so the frames in flight keep the old set and buffer and the new frames use a new set.
+    if (instance_buffer.handle != VK_NULL_HANDLE) {
+        vk_destroy_deferred(instance_buffer);
+        vk_destroy_deferred(vk.descriptor_allocator, descriptor_set_layout, descriptor_set);
+    }
+    instance_count = count;
+    scene_image_valid = false;
+
+    const VkDeviceSize size = count * sizeof(Matrix3x4);
+    instance_buffer = vk_create_buffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, "instance_buffer");
+
+    // The copy is recorded by upload_instance_buffer into the command buffer of the next frame.
+    // The staging buffer is not shared, so the frames in flight can't overwrite it.
+    vk_destroy_deferred(instance_staging_buffer);
+    void* staging_ptr;
+    instance_staging_buffer = vk_create_host_visible_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &staging_ptr, "instance_staging_buffer");
+
+    const uint32_t grid_size = (uint32_t)std::ceil(std::sqrt(double(count)));
+    const float spacing = 1.5f;
+
+    Matrix3x4* transforms = static_cast<Matrix3x4*>(staging_ptr);
+    for (uint32_t i = 0; i < count; i++) {
+        float x = (float(i % grid_size) - float(grid_size - 1) * 0.5f) * spacing;
+        float z = -float(i / grid_size) * spacing;
+        transforms[i] = Matrix3x4::identity;
+        transforms[i].set_column(3, Vector3(x, 0.0f, z));
+    }
+
+    descriptor_set = vk.descriptor_allocator.allocate(descriptor_set_layout);
+    Descriptor_Writes(descriptor_set)
+        .uniform_buffer_dynamic(0, uniform_allocator.buffer.handle, sizeof(Uniform_Buffer))
+        .sampler        (1, sampler)
+        .storage_buffer (2, instance_buffer.handle, 0, size);
+
+    if (gpu_culling_supported)
+        instance_culling.update_instance_buffer(instance_buffer.handle, count);
+}
+
+void Vk_Demo::upload_instance_buffer(VkCommandBuffer command_buffer) {
+    if (instance_staging_buffer.handle == VK_NULL_HANDLE)
+        return;
+
+    VkBufferCopy region;
+    region.srcOffset = 0;
+    region.dstOffset = 0;
+    region.size = instance_count * sizeof(Matrix3x4);
+    vkCmdCopyBuffer(command_buffer, instance_staging_buffer.handle, instance_buffer.handle, 1, &region);
+
+    // Instance transforms are read by the vertex shader and by the culling pass.
+    VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    vk_destroy_deferred(instance_staging_buffer);
+}
+
+// Compares a single instanced draw with one draw call per instance. GPU time is measured with
+// timestamp queries around the draws, CPU time is the time to record the draw commands.
+void Vk_Demo::run_instancing_benchmark() {
+    pipeline_compiler.wait_idle();
+    const uint32_t initial_instance_count = instance_count;
+
+    VkQueryPool query_pool;
+    {
+        VkQueryPoolCreateInfo create_info { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        create_info.queryType   = VK_QUERY_TYPE_TIMESTAMP;
+        create_info.queryCount  = 2;
+        VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &query_pool));
+    }
+
+    uniform_allocator.begin_frame(0);
+    uint32_t uniform_offset;
+    Uniform_Buffer* uniforms = uniform_allocator.allocate<Uniform_Buffer>(&uniform_offset);
+    {
+        float aspect_ratio = (float)vk.surface_size.width / (float)vk.surface_size.height;
+        Matrix4x4 proj = perspective_transform_opengl_z01(radians(45.0f), aspect_ratio, 0.1f, 50.0f);
+        Matrix3x4 view = look_at_transform(camera_pos, Vector3(0), Vector3(0, 1, 0));
+        uniforms->view_proj = proj * view;
+        uniforms->view = Matrix4x4::identity * view;
+        uniforms->model = Matrix4x4::identity;
+    }
+
+    // Returns GPU time in milliseconds. CPU time of the draw recording is returned in cpu_time_ms.
+    auto measure = [this, query_pool, uniform_offset](bool instanced, float* cpu_time_ms) {
+        vk_execute(vk.command_pools[0], vk.queue, [&](VkCommandBuffer cb) {
+            VkViewport viewport{};
+            viewport.width = static_cast<float>(vk.surface_size.width);
+            viewport.height = static_cast<float>(vk.surface_size.height);
+            viewport.maxDepth = 1.0f;
+
+            VkRect2D scissor{};
+            scissor.extent = vk.surface_size;
+
+            VkClearValue clear_values[2] = {};
+            clear_values[1].depthStencil.depth = 1.0;
+
+            VkRenderPassBeginInfo render_pass_begin_info { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+            render_pass_begin_info.renderPass        = render_pass;
+            render_pass_begin_info.framebuffer       = framebuffer;
+            render_pass_begin_info.renderArea.extent = vk.surface_size;
+            render_pass_begin_info.clearValueCount   = (uint32_t)std::size(clear_values);
+            render_pass_begin_info.pClearValues      = clear_values;
+
+            vkCmdResetQueryPool(cb, query_pool, 0, 2);
+            vkCmdBeginRenderPass(cb, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+            vkCmdSetViewport(cb, 0, 1, &viewport);
+            vkCmdSetScissor(cb, 0, 1, &scissor);
+
+            const VkDeviceSize zero_offset = 0;
+            vkCmdBindVertexBuffers(cb, 0, 1, &vertex_buffer.handle, &zero_offset);
+            vkCmdBindIndexBuffer(cb, index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+            VkDescriptorSet sets[] = { descriptor_set, texture_table.set };
+            vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, (uint32_t)std::size(sets), sets, 1, &uniform_offset);
+            vkCmdPushConstants(cb, pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(texture_index), &texture_index);
+            vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.get());
+
+            vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+            Timestamp t;
+            if (instanced) {
+                vkCmdDrawIndexed(cb, model_index_count, instance_count, 0, 0, 0);
+            } else {
+                for (uint32_t i = 0; i < instance_count; i++)
+                    vkCmdDrawIndexed(cb, model_index_count, 1, 0, 0, i);
+            }
+            *cpu_time_ms = elapsed_nanoseconds(t) / 1e6f;
+            vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
+
+            vkCmdEndRenderPass(cb);
+        });
+
+        uint64_t timestamps[2];
+        VK_CHECK(vkGetQueryPoolResults(vk.device, query_pool, 0, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+        return float(double(timestamps[1] - timestamps[0]) * vk.timestamp_period_ms);
+    };
+
+    printf("Instancing benchmark (%u triangles per instance):\n", model_index_count / 3);
+    printf("%10s %22s %22s %22s\n", "instances", "instanced GPU ms", "draw per instance GPU", "draw per instance CPU");
+    for (uint32_t count : instance_count_steps) {
+        create_instance_buffer(count);
+        // The upload is submitted separately, the measured command buffers contain only the draws.
+        vk_execute(vk.command_pools[0], vk.queue, [this](VkCommandBuffer cb) {
+            upload_instance_buffer(cb);
+        });
+
+        // Each variant gets a warm-up run, so the first use of the pipeline and of the
+        // instance data is not measured.
+        float instanced_cpu_time_ms, cpu_time_ms;
+        measure(true, &instanced_cpu_time_ms);
+        float instanced_gpu_time_ms = measure(true, &instanced_cpu_time_ms);
+        measure(false, &cpu_time_ms);
+        float gpu_time_ms = measure(false, &cpu_time_ms);
+        printf("%10u %22.3f %22.3f %22.3f\n", count, instanced_gpu_time_ms, gpu_time_ms, cpu_time_ms);
+    }
+
+    vkDestroyQueryPool(vk.device, query_pool, nullptr);
+    create_instance_buffer(initial_instance_count);
 }
 
-void Vk_Demo::draw_frame() {
-    vk_begin_frame();
+bool Vk_Demo::draw_frame() {
+    CPU_TIME_SCOPE("draw_frame");
+    // The swapchain is out of date, the main loop recreates it and the next frame is drawn.
+    if (!vk_begin_frame()) {
+        ImGui::EndFrame();
+        return false;
+    }
+    uniform_allocator.begin_frame(vk.frame_index);
     begin_gpu_marker_scope(vk.command_buffer, "draw_frame");
-    time_keeper.next_frame();
-    gpu_times.frame->begin();
+    gpu_profiler.begin_frame();
+
+    const Scene_State new_scene_state = get_scene_state();
+    const bool reuse_scene_image = cache_scene_image && scene_image_valid && output_path != Output_Path::direct &&
+        memcmp(&new_scene_state, &scene_state, sizeof(Scene_State)) == 0;
+
+    // Frames with the cached scene are timed separately, so "frame" that feeds dynamic resolution
+    // measures only the frames that render the scene.
+    gpu_profiler.begin_scope(reuse_scene_image ? "cached_frame" : "frame");
+    upload_instance_buffer(vk.command_buffer);
+
+    if (reuse_scene_image) {
+        // render_extent is kept, it describes the cached image.
+        reused_scene_frame_count++;
+    } else {
+        // Only compute copy can upscale, other output paths render at full resolution.
+        if (output_path == Output_Path::compute_copy) {
+            dynamic_resolution.update(gpu_profiler.get_time_ms("frame"), gpu_profiler.get_time_ms("frame/draw"));
+            render_extent = dynamic_resolution.get_render_extent(vk.surface_size);
+        } else {
+            render_extent = vk.surface_size;
+        }
+
+        cull_instances();
+        draw_rasterized_image();
+
+        scene_state = new_scene_state;
+        scene_image_valid = (output_path != Output_Path::direct);
+    }
+
+    if (output_path == Output_Path::compute_copy) {
+        copy_output_image_to_swapchain(reuse_scene_image);
+    } else if (output_path == Output_Path::blit) {
+        blit_output_image_to_swapchain(reuse_scene_image);
+    }
 
-    draw_rasterized_image();
     draw_imgui();
-    copy_output_image_to_swapchain();
-    gpu_times.frame->end();
+    gpu_profiler.end_scope();
 
     end_gpu_marker_scope(vk.command_buffer);
     vk_end_frame();
+    return true;
+}
+
+void Vk_Demo::cull_instances() {
+    GPU_MARKER_SCOPE(vk.command_buffer, "cull_instances");
+    GPU_TIME_SCOPE("cull");
+
+    if (gpu_culling_supported)
+        hi_z.initialize_image_layout(vk.command_buffer);
+
+    if (gpu_culling) {
+        Vector3 bounding_sphere_center = transform_point(model_transform, model_bounding_sphere_center);
+        instance_culling.cull(vk.command_buffer, uniform_allocator,
+            occlusion_culling ? Cull_Phase::occlusion_first_pass : Cull_Phase::frustum,
+            projection_transform * view_transform, bounding_sphere_center, model_bounding_sphere_radius, model_index_count);
+    }
 }
 
 void Vk_Demo::draw_rasterized_image() {
     GPU_MARKER_SCOPE(vk.command_buffer, "draw_rasterized_image");
-    GPU_TIME_SCOPE(gpu_times.draw);
+    GPU_TIME_SCOPE("draw");
+
+    const bool direct = (output_path == Output_Path::direct);
+
+    // The previous frame might still read its uniform data, so each frame gets a new allocation.
+    uint32_t uniform_offset;
+    Uniform_Buffer* uniforms = uniform_allocator.allocate<Uniform_Buffer>(&uniform_offset);
+    uniforms->view_proj = projection_transform * view_transform;
+    uniforms->view = Matrix4x4::identity * view_transform;
+    uniforms->model = Matrix4x4::identity * model_transform;
 
     VkViewport viewport{};
-    viewport.width = static_cast<float>(vk.surface_size.width);
-    viewport.height = static_cast<float>(vk.surface_size.height);
+    viewport.width = static_cast<float>(render_extent.width);
+    viewport.height = static_cast<float>(render_extent.height);
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
 
     VkRect2D scissor{};
-    scissor.extent = vk.surface_size;
+    scissor.extent = render_extent;
 
     vkCmdSetViewport(vk.command_buffer, 0, 1, &viewport);
     vkCmdSetScissor(vk.command_buffer, 0, 1, &scissor);
@@ -411,82 +1015,199 @@ void Vk_Demo::draw_rasterized_image() {
     clear_values[1].depthStencil.depth = 1.0;
     clear_values[1].depthStencil.stencil = 0;
 
-    VkRenderPassBeginInfo render_pass_begin_info { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
-    render_pass_begin_info.renderPass        = render_pass;
-    render_pass_begin_info.framebuffer       = framebuffer;
-    render_pass_begin_info.renderArea.extent = vk.surface_size;
-    render_pass_begin_info.clearValueCount   = (uint32_t)std::size(clear_values);
-    render_pass_begin_info.pClearValues      = clear_values;
+    // Fallback pipeline is returned while the main pipeline is being compiled.
+    VkPipeline mesh_pipeline = direct ? direct_pipeline.get() : pipeline.get();
+
+    // Depth pre-pass is skipped until its pipelines are compiled, there are no fallbacks for them.
+    VkPipeline prepass_pipelines[2] = {
+        direct ? direct_depth_only_pipeline.get() : depth_only_pipeline.get(),
+        direct ? direct_depth_equal_pipeline.get() : depth_equal_pipeline.get()
+    };
+    const bool use_depth_prepass = depth_prepass && prepass_pipelines[0] != VK_NULL_HANDLE && prepass_pipelines[1] != VK_NULL_HANDLE;
+
+    auto draw_meshes = [this, direct, &clear_values, mesh_pipeline, &prepass_pipelines, use_depth_prepass, uniform_offset](bool load_attachments, Cull_Phase cull_phase) {
+        VkRenderPassBeginInfo render_pass_begin_info { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+        if (direct)
+            render_pass_begin_info.renderPass    = load_attachments ? direct_render_pass_load : direct_render_pass;
+        else
+            render_pass_begin_info.renderPass    = load_attachments ? render_pass_load : render_pass;
+        render_pass_begin_info.framebuffer       = direct ? direct_framebuffers[vk.swapchain_image_index] : framebuffer;
+        render_pass_begin_info.renderArea.extent = render_extent;
+        render_pass_begin_info.clearValueCount   = load_attachments ? 0 : (uint32_t)std::size(clear_values);
+        render_pass_begin_info.pClearValues      = load_attachments ? nullptr : clear_values;
+
+        vkCmdBeginRenderPass(vk.command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+        if (mesh_pipeline != VK_NULL_HANDLE) {
+            const VkDeviceSize zero_offset = 0;
+            vkCmdBindVertexBuffers(vk.command_buffer, 0, 1, &vertex_buffer.handle, &zero_offset);
+            vkCmdBindIndexBuffer(vk.command_buffer, index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
+            VkDescriptorSet sets[] = { descriptor_set, texture_table.set };
+            vkCmdBindDescriptorSets(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, (uint32_t)std::size(sets), sets, 1, &uniform_offset);
+            vkCmdPushConstants(vk.command_buffer, pipeline_layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(texture_index), &texture_index);
+
+            auto draw_instances = [this, cull_phase]() {
+                if (gpu_culling)
+                    instance_culling.draw(vk.command_buffer, cull_phase);
+                else
+                    vkCmdDrawIndexed(vk.command_buffer, model_index_count, instance_count, 0, 0, 0);
+            };
+            // Both draws are in the same subpass, so the main draw sees the depth written by the pre-pass.
+            if (use_depth_prepass) {
+                vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, prepass_pipelines[0]);
+                draw_instances();
+                vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, prepass_pipelines[1]);
+                draw_instances();
+            } else {
+                vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, mesh_pipeline);
+                draw_instances();
+            }
+        }
+        vkCmdEndRenderPass(vk.command_buffer);
+    };
+
+    // Statistics of the frame that used this frame slot are available after the fence wait.
+    VkQueryPool statistics_query_pool = VK_NULL_HANDLE;
+    if (vk.pipeline_statistics_supported) {
+        statistics_query_pool = pipeline_statistics_query_pools[vk.frame_index];
+        uint64_t results[2];
+        if (vkGetQueryPoolResults(vk.device, statistics_query_pool, 0, 1, sizeof(results), results, sizeof(results), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            pipeline_statistics[0] = results[0];
+            pipeline_statistics[1] = results[1];
+        }
+        vkCmdResetQueryPool(vk.command_buffer, statistics_query_pool, 0, 1);
+        vkCmdBeginQuery(vk.command_buffer, statistics_query_pool, 0, 0);
+    }
 
-    vkCmdBeginRenderPass(vk.command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-    const VkDeviceSize zero_offset = 0;
-    vkCmdBindVertexBuffers(vk.command_buffer, 0, 1, &vertex_buffer.handle, &zero_offset);
-    vkCmdBindIndexBuffer(vk.command_buffer, index_buffer.handle, 0, VK_INDEX_TYPE_UINT32);
-    vkCmdBindDescriptorSets(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &descriptor_set, 0, nullptr);
-    vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-    vkCmdDrawIndexed(vk.command_buffer, model_index_count, 1, 0, 0, 0);
-    vkCmdEndRenderPass(vk.command_buffer);
+    const bool occlusion = gpu_culling && occlusion_culling && !vk.depth_info.transient;
+
+    // Occlusion culling: the first pass draws instances visible in the previous frame, Hi-Z is
+    // built from their depth, the second pass draws instances that are not occluded by them.
+    {
+        GPU_TIME_SCOPE("first_pass");
+        draw_meshes(false, occlusion ? Cull_Phase::occlusion_first_pass : Cull_Phase::frustum);
+    }
+    if (occlusion) {
+        {
+            GPU_TIME_SCOPE("hi_z");
+            hi_z.build(vk.command_buffer, vk.depth_info.image, render_extent);
+
+            Vector3 bounding_sphere_center = transform_point(model_transform, model_bounding_sphere_center);
+            instance_culling.cull(vk.command_buffer, uniform_allocator, Cull_Phase::occlusion_second_pass,
+                projection_transform * view_transform, bounding_sphere_center, model_bounding_sphere_radius, model_index_count);
+        }
+        GPU_TIME_SCOPE("second_pass");
+        draw_meshes(true, Cull_Phase::occlusion_second_pass);
+    }
+
+    if (statistics_query_pool != VK_NULL_HANDLE)
+        vkCmdEndQuery(vk.command_buffer, statistics_query_pool, 0);
+
+    if (direct) {
+        // UI pass loads swapchain image written by this pass.
+        vk_cmd_image_barrier(vk.command_buffer, vk.swapchain_info.images[vk.swapchain_image_index],
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,  VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,           VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,       VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    }
 }
 
 void Vk_Demo::draw_imgui() {
     GPU_MARKER_SCOPE(vk.command_buffer, "draw_imgui");
-    GPU_TIME_SCOPE(gpu_times.ui);
+    GPU_TIME_SCOPE("ui");
 
     ImGui::Render();
 
-    vk_cmd_image_barrier(vk.command_buffer, output_image.handle,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        0,                                          VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,   VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-
+    // The render pass also transitions swapchain image to PRESENT_SRC_KHR layout.
     VkRenderPassBeginInfo render_pass_begin_info{ VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
     render_pass_begin_info.renderPass           = ui_render_pass;
-    render_pass_begin_info.framebuffer          = ui_framebuffer;
+    render_pass_begin_info.framebuffer          = ui_framebuffers[vk.swapchain_image_index];
     render_pass_begin_info.renderArea.extent    = vk.surface_size;
 
     vkCmdBeginRenderPass(vk.command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
     ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), vk.command_buffer);
     vkCmdEndRenderPass(vk.command_buffer);
-
-    vk_cmd_image_barrier(vk.command_buffer, output_image.handle,
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,           VK_ACCESS_SHADER_READ_BIT,
-        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 }
 
-void Vk_Demo::copy_output_image_to_swapchain() {
+void Vk_Demo::copy_output_image_to_swapchain(bool cached_scene) {
     GPU_MARKER_SCOPE(vk.command_buffer, "copy_output_image_to_swapchain");
-    GPU_TIME_SCOPE(gpu_times.compute_copy);
+    GPU_TIME_SCOPE("output_copy");
 
-    const uint32_t group_size_x = 32; // according to shader
-    const uint32_t group_size_y = 32;
+    const Workgroup_Size group_size = copy_to_swapchain.workgroup_size;
 
-    uint32_t group_count_x = (vk.surface_size.width + group_size_x - 1) / group_size_x;
-    uint32_t group_count_y = (vk.surface_size.height + group_size_y - 1) / group_size_y;
+    uint32_t group_count_x = (vk.surface_size.width + group_size.x - 1) / group_size.x;
+    uint32_t group_count_y = (vk.surface_size.height + group_size.y - 1) / group_size.y;
 
-    vk_cmd_image_barrier(vk.command_buffer, vk.swapchain_info.images[vk.swapchain_image_index],
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-        0,                                  VK_ACCESS_SHADER_WRITE_BIT,
-        VK_IMAGE_LAYOUT_UNDEFINED,          VK_IMAGE_LAYOUT_GENERAL);
+    if (!cached_scene) {
+        vk_cmd_image_barrier(vk.command_buffer, output_image.handle,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,           VK_ACCESS_SHADER_READ_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
 
-    uint32_t push_constants[] = { vk.surface_size.width, vk.surface_size.height };
+    vk_cmd_image_barrier(vk.command_buffer, vk.swapchain_info.images[vk.swapchain_image_index],
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,                                      VK_ACCESS_SHADER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED,              VK_IMAGE_LAYOUT_GENERAL);
+
+    Copy_To_Swapchain::Push_Constants push_constants;
+    push_constants.viewport_size[0] = vk.surface_size.width;
+    push_constants.viewport_size[1] = vk.surface_size.height;
+    push_constants.src_scale[0] = float(render_extent.width) / float(vk.surface_size.width);
+    push_constants.src_scale[1] = float(render_extent.height) / float(vk.surface_size.height);
+    push_constants.upscale_filter = upscale_filter;
+    push_constants.sharpness = sharpness;
 
     vkCmdPushConstants(vk.command_buffer, copy_to_swapchain.pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
-        0, sizeof(push_constants), push_constants);
+        0, sizeof(push_constants), &push_constants);
 
-    vkCmdBindDescriptorSets(vk.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, copy_to_swapchain.pipeline_layout,
-        0, 1, &copy_to_swapchain.sets[vk.swapchain_image_index], 0, nullptr);
+    copy_to_swapchain.bind_descriptors(vk.command_buffer, vk.swapchain_image_index);
 
     vkCmdBindPipeline(vk.command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, copy_to_swapchain.pipeline);
     vkCmdDispatch(vk.command_buffer, group_count_x, group_count_y, 1);
 
     vk_cmd_image_barrier(vk.command_buffer, vk.swapchain_info.images[vk.swapchain_image_index],
-        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,   VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-        VK_ACCESS_SHADER_WRITE_BIT,             0,
-        VK_IMAGE_LAYOUT_GENERAL,                VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,   VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_ACCESS_SHADER_WRITE_BIT,             VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_GENERAL,                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+}
+
+void Vk_Demo::blit_output_image_to_swapchain(bool cached_scene) {
+    GPU_MARKER_SCOPE(vk.command_buffer, "blit_output_image_to_swapchain");
+    GPU_TIME_SCOPE("output_copy");
+
+    if (!cached_scene) {
+        vk_cmd_image_barrier(vk.command_buffer, output_image.handle,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,  VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,           VK_ACCESS_TRANSFER_READ_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    }
+
+    vk_cmd_image_barrier(vk.command_buffer, vk.swapchain_info.images[vk.swapchain_image_index],
+        VK_PIPELINE_STAGE_TRANSFER_BIT,         VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,                                      VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED,              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    VkImageBlit blit{};
+    blit.srcSubresource.aspectMask  = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcSubresource.layerCount  = 1;
+    blit.srcOffsets[1]              = VkOffset3D { (int32_t)vk.surface_size.width, (int32_t)vk.surface_size.height, 1 };
+    blit.dstSubresource.aspectMask  = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.dstSubresource.layerCount  = 1;
+    blit.dstOffsets[1]              = blit.srcOffsets[1];
+
+    vkCmdBlitImage(vk.command_buffer,
+        output_image.handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        vk.swapchain_info.images[vk.swapchain_image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1, &blit, VK_FILTER_NEAREST);
+
+    vk_cmd_image_barrier(vk.command_buffer, vk.swapchain_info.images[vk.swapchain_image_index],
+        VK_PIPELINE_STAGE_TRANSFER_BIT,         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT,           VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,   VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 }
 
 void Vk_Demo::do_imgui() {
+    CPU_TIME_SCOPE("do_imgui");
     ImGuiIO& io = ImGui::GetIO();
 
     ImGui_ImplVulkan_NewFrame();
@@ -524,14 +1245,148 @@ void Vk_Demo::do_imgui() {
             ImGuiWindowFlags_NoFocusOnAppearing | ImGuiWindowFlags_NoNav))
         {
             ImGui::Text("%.1f FPS (%.3f ms/frame)", ImGui::GetIO().Framerate, 1000.0f / ImGui::GetIO().Framerate);
-            ImGui::Text("Frame time         : %.2f ms", gpu_times.frame->length_ms);
-            ImGui::Text("Draw time          : %.2f ms", gpu_times.draw->length_ms);
-            ImGui::Text("UI time            : %.2f ms", gpu_times.ui->length_ms);
-            ImGui::Text("Compute copy time  : %.2f ms", gpu_times.compute_copy->length_ms);
+            ImGui::Text("Frame time         : %.2f ms", gpu_profiler.get_time_ms("frame"));
+            ImGui::Text("Cull time          : %.2f ms", gpu_profiler.get_time_ms("frame/cull"));
+            ImGui::Text("Draw time          : %.2f ms (%u x %u)", gpu_profiler.get_time_ms("frame/draw"), render_extent.width, render_extent.height);
+            ImGui::Text("Hi-Z + recull time : %.2f ms", gpu_profiler.get_time_ms("frame/draw/hi_z"));
+            ImGui::Text("UI time            : %.2f ms", gpu_profiler.get_time_ms("frame/ui"));
+            ImGui::Text("Output copy time   : %.2f ms%s", gpu_profiler.get_time_ms("frame/output_copy"),
+                (output_path == Output_Path::compute_copy && (render_extent.width != vk.surface_size.width || sharpness > 0.f)) ? " (upscale)" : "");
             ImGui::Separator();
             ImGui::Spacing();
             ImGui::Checkbox("Vertical sync", &vsync);
             ImGui::Checkbox("Animate", &animate);
+            ImGui::Checkbox("Depth pre-pass", &depth_prepass);
+
+            int instance_step = int(std::find(std::begin(instance_count_steps), std::end(instance_count_steps), instance_count) - std::begin(instance_count_steps));
+            if (ImGui::Combo("Instances", &instance_step, "1\0" "10\0" "100\0" "1K\0" "10K\0" "100K\0" "1M\0"))
+                create_instance_buffer(instance_count_steps[instance_step]);
+
+            if (gpu_culling_supported) {
+                ImGui::Checkbox("GPU frustum culling", &gpu_culling);
+                if (gpu_culling) {
+                    if (vk.depth_info.transient)
+                        ImGui::Text("Hi-Z occlusion culling needs non-transient depth");
+                    else
+                        ImGui::Checkbox("Hi-Z occlusion culling", &occlusion_culling);
+
+                    const Cull_Stats& stats = instance_culling.stats;
+                    const uint64_t triangle_count = model_index_count / 3;
+                    ImGui::Text("Drawn instances    : %u / %u", stats.first_pass_draw_count + stats.second_pass_draw_count, instance_count);
+                    ImGui::Text("Frustum culled     : %u", instance_count - stats.frustum_visible_count);
+                    if (occlusion_culling && !vk.depth_info.transient) {
+                        ImGui::Text("Occlusion culled   : %u (%" PRIu64 " triangles)", stats.occluded_count, stats.occluded_count * triangle_count);
+                        ImGui::Text("Second pass draws  : %u", stats.second_pass_draw_count);
+                    }
+                }
+            }
+            if (vk.pipeline_statistics_supported) {
+                ImGui::Text("Triangles          : %" PRIu64 "%s", pipeline_statistics[0], depth_prepass ? " (pre-pass included)" : "");
+                ImGui::Text("Fragment shaders   : %" PRIu64, pipeline_statistics[1]);
+            }
+
+            int path = static_cast<int>(output_path);
+            if (ImGui::Combo("Output path", &path, "Compute copy\0Blit\0Direct render\0")) {
+                output_path = static_cast<Output_Path>(path);
+                if (output_path == Output_Path::blit && !blit_supported)
+                    output_path = Output_Path::compute_copy;
+            }
+
+            if (ImGui::CollapsingHeader("Frame pacing")) {
+                ImGui::SliderFloat("Target FPS", &frame_pacer.target_fps, 0.f, 240.f, frame_pacer.target_fps > 0.f ? "%.0f" : "unlimited");
+                ImGui::Text("Fence wait         : %.2f ms", frame_pacer.fence_wait_ms);
+                ImGui::Text("Limiter wait       : %.2f ms", frame_pacer.limiter_wait_ms);
+                ImGui::Text("Input to submit    : %.2f ms", frame_pacer.input_to_submit_ms);
+                ImGui::Checkbox("Render on demand", &render_on_demand);
+                if (render_on_demand) {
+                    ImGui::Text("Last idle period   : %.2f s, %u wakeups", idle.duration_s, idle.last_wakeups);
+                    ImGui::Text("Idle CPU usage     : %.2f%% of one core", idle.cpu_usage * 100.f);
+                }
+            }
+
+            if (output_path != Output_Path::direct) {
+                ImGui::Checkbox("Cache scene image", &cache_scene_image);
+                if (cache_scene_image)
+                    ImGui::Text("Scene pass skipped : %" PRIu64 " frames", reused_scene_frame_count);
+            }
+
+            ImGui::Checkbox("Dynamic resolution", &dynamic_resolution.enabled);
+            if (dynamic_resolution.enabled)
+                ImGui::SliderFloat("Target frame time", &dynamic_resolution.target_frame_time_ms, 2.f, 50.f, "%.1f ms");
+            else
+                ImGui::SliderFloat("Render scale", &dynamic_resolution.fixed_scale, Dynamic_Resolution::min_scale, Dynamic_Resolution::max_scale, "%.2f");
+
+            if (output_path == Output_Path::compute_copy) {
+                ImGui::Text("Render resolution  : %u x %u (%.0f%%)", render_extent.width, render_extent.height, dynamic_resolution.scale * 100.f);
+                int filter = static_cast<int>(upscale_filter);
+                if (ImGui::Combo("Upscale filter", &filter, "Bilinear\0Edge adaptive\0"))
+                    upscale_filter = static_cast<Upscale_Filter>(filter);
+                ImGui::SliderFloat("Sharpening", &sharpness, 0.f, 1.f, "%.2f");
+            } else {
+                ImGui::Text("Render resolution  : full, upscaling needs compute copy");
+            }
+
+            if (ImGui::CollapsingHeader("GPU scopes")) {
+                ImGui::Text("Results latency    : %" PRIu64 " frames", vk.submitted_frame_count - gpu_profiler.timings_frame);
+                ImGui::Text("Unavailable scopes : %" PRIu64, gpu_profiler.unavailable_scope_count);
+                for (const GPU_Scope_Timing& timing : gpu_profiler.frame_timings) {
+                    const GPU_Scope_Node& node = gpu_profiler.nodes[timing.node];
+                    if (timing.available)
+                        ImGui::Text("%*s%-*s: %6.3f ms (avg %.3f ms)", int(2 * timing.depth), "", int(20 - 2 * timing.depth), node.name.c_str(),
+                            timing.length_ms, node.length_ms);
+                    else
+                        ImGui::Text("%*s%-*s: n/a (avg %.3f ms)", int(2 * timing.depth), "", int(20 - 2 * timing.depth), node.name.c_str(),
+                            node.length_ms);
+                }
+                if (ImGui::Button("Save to gpu_timings.json"))
+                    gpu_profiler.save_frame_timings("gpu_timings.json");
+            }
+
+            if (ImGui::CollapsingHeader("Trace capture")) {
+                ImGui::SliderInt("Frames", &trace_frame_count, 1, 120);
+                if (trace_capture.is_active())
+                    ImGui::Text("Capturing...");
+                else if (ImGui::Button("Capture to trace.json"))
+                    trace_capture.start(uint32_t(trace_frame_count), "trace.json");
+                ImGui::Text("GPU clock alignment: %s, +/- %.1f us", vk.calibrated_timestamps_supported ? "calibrated timestamps" : "timestamp query",
+                    trace_capture.calibration_error_us);
+                if (!trace_capture.last_file_name.empty())
+                    ImGui::Text("Written: %s", trace_capture.last_file_name.c_str());
+            }
+
+            if (ImGui::CollapsingHeader("Pipeline compile times")) {
+                if (uint32_t failed_count = pipeline_compiler.get_failed_job_count())
+                    ImGui::Text("Failed pipelines   : %u, fallbacks are used", failed_count);
+                for (const Pipeline_Compile_Stats& stats : pipeline_compiler.get_compile_stats()) {
+                    if (stats.failed)
+                        ImGui::Text("%-24s: failed", stats.name.c_str());
+                    else
+                        ImGui::Text("%-24s: %.2f ms", stats.name.c_str(), stats.compile_time_ms);
+                }
+            }
+
+            if (ImGui::CollapsingHeader("Descriptor pools")) {
+                auto show_stats = [](const char* name, const Vk_Descriptor_Allocator& allocator) {
+                    ImGui::Text("%-10s: %u sets (peak %u), %u pools x %u sets", name,
+                        allocator.allocated_set_count, allocator.max_allocated_set_count,
+                        (uint32_t)allocator.pools.size(), allocator.sets_per_pool);
+                };
+                show_stats("Persistent", vk.descriptor_allocator);
+                show_stats("Per-frame", *vk.frame_descriptor_allocator);
+                ImGui::Text("Copy backend: %s", copy_to_swapchain.use_push_descriptors ? "push descriptors" : "descriptor sets");
+            }
+
+            if (ImGui::CollapsingHeader("Depth buffer")) {
+                const float mb = 1.f / (1024.f * 1024.f);
+                const VkDeviceSize committed_size = vk_get_depth_buffer_committed_size();
+                ImGui::Text("Format     : %s", string_VkFormat(vk.depth_info.format));
+                ImGui::Text("Memory     : %s", vk.depth_info.lazily_allocated ? "transient, lazily allocated" :
+                                               (vk.depth_info.transient ? "transient, device local" : "device local"));
+                ImGui::Text("Size       : %.2f MB (committed %.2f MB)", vk.depth_info.memory_size * mb, committed_size * mb);
+                ImGui::Text("Baseline   : %.2f MB (D24S8/D32S8 non-transient)", vk.depth_info.baseline_memory_size * mb);
+                ImGui::Text("Saved      : %.2f MB at %u x %u", (float(vk.depth_info.baseline_memory_size) - float(committed_size)) * mb,
+                    vk.surface_size.width, vk.surface_size.height);
+            }
 
             if (ImGui::BeginPopupContextWindow()) {
                 if (ImGui::MenuItem("Custom",       NULL, corner == -1)) corner = -1;
@@ -1,7 +1,17 @@
 #pragma once
 
 #include "copy_to_swapchain.h"
+#include "dynamic_resolution.h"
+#include "file_watcher.h"
+#include "frame_pacer.h"
+#include "gpu_profiler.h"
+#include "hi_z.h"
+#include "instance_culling.h"
 #include "matrix.h"
+#include "pipeline_compiler.h"
+#include "texture_table.h"
+#include "trace_capture.h"
+#include "uniform_allocator.h"
 #include "utils.h"
 #include "vk.h"
 
@@ -9,23 +19,82 @@
 
 struct GLFWwindow;
 
+struct Command_Line_Options {
+    bool enable_validation_layers;
+    bool tune_workgroup_sizes;
+    bool benchmark_descriptors;
+    bool benchmark_instancing;
+    bool transient_depth;
+    bool compile_shaders;
+    bool shader_hot_reload;
+    std::string shader_dir = "./src/shaders";
+    Descriptor_Backend descriptor_backend = Descriptor_Backend::push_descriptors;
+    float render_scale = 1.0f;
+    Upscale_Filter upscale_filter = Upscale_Filter::edge_adaptive;
+    float sharpness = 0.0f;
+    float target_fps = 0.0f;
+    bool render_on_demand = false;
+};
+
+// Specifies how the final image gets into the swapchain image.
+enum class Output_Path : int {
+    compute_copy,   // compute shader samples output_image and writes swapchain image
+    blit,           // vkCmdBlitImage from output_image to swapchain image
+    direct          // scene is rendered directly into swapchain image
+};
+
+// Inputs of the scene pass. The cached scene image is reused while they don't change.
+// Compared with memcmp, so the padding is cleared with memset when the state is filled.
+struct Scene_State {
+    Matrix3x4   model_transform;
+    Matrix3x4   view_transform;
+    Matrix4x4   projection_transform;
+    VkPipeline  pipelines[3]; // mesh pipeline and depth pre-pass pipelines
+    uint32_t    instance_count;
+    Output_Path output_path;
+    float       fixed_render_scale;
+    bool        dynamic_resolution;
+    bool        gpu_culling;
+    bool        occlusion_culling;
+    bool        depth_prepass;
+};
+
 class Vk_Demo {
 public:
-    void initialize(GLFWwindow* glfw_window, bool enable_validation_layers);
+    void initialize(GLFWwindow* glfw_window, const Command_Line_Options& options);
     void shutdown();
 
     void release_resolution_dependent_resources();
     void restore_resolution_dependent_resources();
     bool vsync_enabled() const { return vsync; }
 
+    // Blocks until the next frame can be recorded. Input should be polled after this call.
+    void wait_for_next_frame();
+    // Should be called right after input is polled, the camera is latched from the current input.
     void run_frame();
 
+    // Render-on-demand mode. A frame is needed when the animation is on, pipelines are being
+    // compiled or request_redraw was called recently. Otherwise the frame loop calls wait_for_events.
+    bool needs_frame() const;
+    // Called on input events and window changes.
+    void request_redraw();
+    // Blocks until window events arrive or the timeout that polls shader changes expires.
+    void wait_for_events();
+
 private:
-    void draw_frame();
+    bool draw_frame(); // returns false if the frame was skipped
+    void cull_instances();
     void draw_rasterized_image();
     void draw_imgui();
-    void copy_output_image_to_swapchain();
+    // cached_scene is true if output_image is already in the layout of the previous copy.
+    void copy_output_image_to_swapchain(bool cached_scene);
+    void blit_output_image_to_swapchain(bool cached_scene);
     void do_imgui();
+    void update_shader_hot_reload();
+    void create_instance_buffer(uint32_t instance_count);
+    void upload_instance_buffer(VkCommandBuffer command_buffer);
+    void run_instancing_benchmark();
+    Scene_State get_scene_state() const;
 
 private:
     using Clock = std::chrono::high_resolution_clock;
@@ -34,40 +103,112 @@ private:
     bool                        show_ui                 = true;
     bool                        vsync                   = true;
     bool                        animate                 = false;
+    bool                        gpu_culling             = false;
+    bool                        occlusion_culling       = false;
+    bool                        gpu_culling_supported;
+    bool                        depth_prepass           = false;
+    bool                        render_on_demand        = false;
+    Output_Path                 output_path             = Output_Path::compute_copy;
+    bool                        blit_supported;
 
     Time                        last_frame_time;
     double                      sim_time;
+    Frame_Pacer                 frame_pacer;
+    Trace_Capture               trace_capture;
+    int                         trace_frame_count = 10;
+    uint32_t                    redraw_frame_count = 0; // frames to render before the loop becomes idle
+    std::vector<std::string>    modified_shader_files; // detected while idle
+
+    struct {
+        bool                    active          = false;
+        Timestamp               start_time;
+        double                  start_cpu_time  = 0.0;
+        uint32_t                wakeups         = 0;
+        // The last finished idle period.
+        float                   duration_s      = 0.f;
+        float                   cpu_usage       = 0.f; // process CPU time relative to wall time, 1.0 is one core
+        uint32_t                last_wakeups    = 0;
+    } idle;
 
     VkRenderPass                ui_render_pass;
-    VkFramebuffer               ui_framebuffer;
-    Vk_Image                    output_image;
+    VkDescriptorPool            imgui_descriptor_pool;
+    std::vector<VkFramebuffer>  ui_framebuffers; // per swapchain image
+    Vk_Image                    output_image; // full size, the scene is rendered into its render_extent area
+
+    // output_image keeps the scene of the last frame. When only UI changes, the scene pass is
+    // skipped and the cached image is copied to the swapchain again. Direct render path can't
+    // use the cache because the scene is rendered into the swapchain image.
+    bool                        cache_scene_image       = true;
+    bool                        scene_image_valid; // output_image contains the scene of scene_state
+    Scene_State                 scene_state;
+    uint64_t                    reused_scene_frame_count;
+    Dynamic_Resolution          dynamic_resolution;
+    Upscale_Filter              upscale_filter;
+    float                       sharpness;
+    VkExtent2D                  render_extent;
     Copy_To_Swapchain           copy_to_swapchain;
 
     VkDescriptorSetLayout       descriptor_set_layout;
     VkPipelineLayout            pipeline_layout;
-    VkPipeline                  pipeline;
+    Pipeline_Compiler           pipeline_compiler;
+    Async_Pipeline              pipeline;
+    VkPipeline                  fallback_pipeline;
     VkDescriptorSet             descriptor_set;
     VkRenderPass                render_pass;
+    VkRenderPass                render_pass_load; // loads color and depth, used by the second occlusion culling pass
     VkFramebuffer               framebuffer;
-    Vk_Buffer                   uniform_buffer;
-    void*                       mapped_uniform_buffer;
+    VkRenderPass                direct_render_pass;
+    VkRenderPass                direct_render_pass_load;
+    Async_Pipeline              direct_pipeline;
+    VkPipeline                  direct_fallback_pipeline;
+    std::vector<VkFramebuffer>  direct_framebuffers; // per swapchain image
+
+    // Depth pre-pass: position-only pipeline without fragment shader writes depth, then
+    // mesh pipeline with EQUAL depth test and disabled depth writes shades visible fragments.
+    Async_Pipeline              depth_only_pipeline;
+    Async_Pipeline              depth_equal_pipeline;
+    Async_Pipeline              direct_depth_only_pipeline;
+    Async_Pipeline              direct_depth_equal_pipeline;
+
+    bool                        shader_hot_reload;
+    File_Watcher                shader_watcher;
+    Vk_Graphics_Pipeline_State  mesh_pipeline_state; // to rebuild mesh pipelines after shader change
+    Reloaded_Pipeline           reloaded_pipeline;
+    Reloaded_Pipeline           reloaded_direct_pipeline;
+    Vk_Graphics_Pipeline_State  depth_only_pipeline_state;
+    Vk_Graphics_Pipeline_State  depth_equal_pipeline_state;
+    Reloaded_Pipeline           reloaded_depth_only_pipeline;
+    Reloaded_Pipeline           reloaded_depth_equal_pipeline;
+    Reloaded_Pipeline           reloaded_direct_depth_only_pipeline;
+    Reloaded_Pipeline           reloaded_direct_depth_equal_pipeline;
+    Reloaded_Pipeline           reloaded_copy_pipeline;
+    Reloaded_Pipeline           reloaded_cull_pipeline;
+    Reloaded_Pipeline           reloaded_hi_z_pipeline;
+
+    Uniform_Allocator           uniform_allocator;
 
     Vk_Buffer                   vertex_buffer;
     Vk_Buffer                   index_buffer;
     uint32_t                    model_vertex_count;
     uint32_t                    model_index_count;
+    Vk_Buffer                   instance_buffer; // Matrix3x4 transform per instance
+    Vk_Buffer                   instance_staging_buffer; // transforms not yet copied to instance_buffer
+    uint32_t                    instance_count;
+    Vector3                     model_bounding_sphere_center;
+    float                       model_bounding_sphere_radius;
+    Instance_Culling            instance_culling;
+    Hi_Z_Pyramid                hi_z;
+
+    VkQueryPool                 pipeline_statistics_query_pools[2]; // per frame in flight
+    uint64_t                    pipeline_statistics[2]; // input assembly primitives, fragment shader invocations
+
     Vk_Image                    texture;
+    Bindless_Texture_Table      texture_table;
+    uint32_t                    texture_index; // in texture_table
     VkSampler                   sampler;
 
     Vector3                     camera_pos = Vector3(0, 0.5, 3.0);
     Matrix3x4                   model_transform;
     Matrix3x4                   view_transform;
-
-    GPU_Time_Keeper             time_keeper;
-    struct {
-        GPU_Time_Interval*      frame;
-        GPU_Time_Interval*      draw;
-        GPU_Time_Interval*      ui;
-        GPU_Time_Interval*      compute_copy;
-    } gpu_times;
+    Matrix4x4                   projection_transform;
 };
@@ -0,0 +1,213 @@
+#include "common.h"
+#include "descriptor_benchmark.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <vector>
+
+// Each bind provides a sampler, a sampled image and a storage image, the same set of
+// descriptors as Copy_To_Swapchain uses. Commands are only recorded, never submitted.
+void run_descriptor_bind_benchmark() {
+    const uint32_t bind_count = 10000; // per run
+    const int run_count = 5; // the best run is reported
+
+    Vk_Image image = vk_create_image(16, 16, VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, "descriptor_benchmark_image");
+
+    VkSampler sampler;
+    {
+        VkSamplerCreateInfo create_info { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+        VK_CHECK(vkCreateSampler(vk.device, &create_info, nullptr, &sampler));
+    }
+
+    auto create_pipeline_layout = [](VkDescriptorSetLayout set_layout) {
+        VkPipelineLayoutCreateInfo create_info { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+        create_info.setLayoutCount  = 1;
+        create_info.pSetLayouts     = &set_layout;
+        VkPipelineLayout pipeline_layout;
+        VK_CHECK(vkCreatePipelineLayout(vk.device, &create_info, nullptr, &pipeline_layout));
+        return pipeline_layout;
+    };
+
+    Descriptor_Set_Layout layout;
+    layout
+        .sampler        (0, VK_SHADER_STAGE_COMPUTE_BIT)
+        .sampled_image  (1, VK_SHADER_STAGE_COMPUTE_BIT)
+        .storage_image  (2, VK_SHADER_STAGE_COMPUTE_BIT);
+
+    VkDescriptorSetLayout set_layout = layout.create("descriptor_benchmark_set_layout");
+    VkPipelineLayout pipeline_layout = create_pipeline_layout(set_layout);
+    VkDescriptorUpdateTemplate set_template = layout.create_update_template(set_layout, "descriptor_benchmark_set_template");
+
+    VkDescriptorSetLayout push_set_layout = VK_NULL_HANDLE;
+    VkPipelineLayout push_pipeline_layout = VK_NULL_HANDLE;
+    VkDescriptorUpdateTemplate push_template = VK_NULL_HANDLE;
+    if (vk.push_descriptors_supported) {
+        layout.push_descriptors();
+        push_set_layout = layout.create("descriptor_benchmark_push_set_layout");
+        push_pipeline_layout = create_pipeline_layout(push_set_layout);
+        push_template = layout.create_push_update_template(VK_PIPELINE_BIND_POINT_COMPUTE, push_pipeline_layout, 0, "descriptor_benchmark_push_template");
+    }
+
+    VkDescriptorPool descriptor_pool;
+    {
+        VkDescriptorPoolSize pool_sizes[] = {
+            {VK_DESCRIPTOR_TYPE_SAMPLER,        bind_count},
+            {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,  bind_count},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,  bind_count},
+        };
+        VkDescriptorPoolCreateInfo create_info { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+        create_info.maxSets         = bind_count;
+        create_info.poolSizeCount   = (uint32_t)std::size(pool_sizes);
+        create_info.pPoolSizes      = pool_sizes;
+        VK_CHECK(vkCreateDescriptorPool(vk.device, &create_info, nullptr, &descriptor_pool));
+    }
+
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    {
+        VkCommandPoolCreateInfo create_info { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+        create_info.flags               = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        create_info.queueFamilyIndex    = vk.queue_family_index;
+        VK_CHECK(vkCreateCommandPool(vk.device, &create_info, nullptr, &command_pool));
+
+        VkCommandBufferAllocateInfo alloc_info { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+        alloc_info.commandPool          = command_pool;
+        alloc_info.level                = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount   = 1;
+        VK_CHECK(vkAllocateCommandBuffers(vk.device, &alloc_info, &command_buffer));
+    }
+
+    const Descriptor_Template_Data template_data = Descriptor_Template_Data()
+        .sampler        (sampler)
+        .sampled_image  (image.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+        .storage_image  (image.view);
+
+    auto allocate_set = [descriptor_pool, set_layout]() {
+        VkDescriptorSetAllocateInfo alloc_info { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+        alloc_info.descriptorPool     = descriptor_pool;
+        alloc_info.descriptorSetCount = 1;
+        alloc_info.pSetLayouts        = &set_layout;
+        VkDescriptorSet set;
+        VK_CHECK(vkAllocateDescriptorSets(vk.device, &alloc_info, &set));
+        return set;
+    };
+
+    double baseline_ns = 0.0; // the first measured variant, other variants report speedup relative to it
+
+    auto measure = [command_pool, command_buffer, descriptor_pool, &baseline_ns](const char* name, auto bind_descriptors) {
+        int64_t best_time_ns = std::numeric_limits<int64_t>::max();
+        for (int run = 0; run < run_count; run++) {
+            VK_CHECK(vkResetDescriptorPool(vk.device, descriptor_pool, 0));
+            VK_CHECK(vkResetCommandPool(vk.device, command_pool, 0));
+
+            VkCommandBufferBeginInfo begin_info { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+            begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            VK_CHECK(vkBeginCommandBuffer(command_buffer, &begin_info));
+
+            Timestamp t;
+            for (uint32_t i = 0; i < bind_count; i++)
+                bind_descriptors(command_buffer);
+            best_time_ns = std::min(best_time_ns, elapsed_nanoseconds(t));
+
+            VK_CHECK(vkEndCommandBuffer(command_buffer));
+        }
+        double time_ns = double(best_time_ns) / bind_count;
+        if (baseline_ns == 0.0)
+            baseline_ns = time_ns;
+        printf("%-62s %7.1f ns (%.2fx)\n", name, time_ns, baseline_ns / time_ns);
+    };
+
+    printf("Descriptor bind cost (CPU time per dispatch, %u binds):\n", bind_count);
+    printf("[stand-in] rows approximate a descriptor buffer backend with preallocated sets\n");
+
+    measure("allocate set + vkUpdateDescriptorSets + bind", [&](VkCommandBuffer cb) {
+        VkDescriptorSet set = allocate_set();
+        Descriptor_Writes(set)
+            .sampler        (0, sampler)
+            .sampled_image  (1, image.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+            .storage_image  (2, image.view);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &set, 0, nullptr);
+    });
+
+    measure("allocate set + update template + bind", [&](VkCommandBuffer cb) {
+        VkDescriptorSet set = allocate_set();
+        vkUpdateDescriptorSetWithTemplate(vk.device, set, set_template, template_data.infos);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &set, 0, nullptr);
+    });
+
+    // Preallocated sets are rewritten before each bind. This is a stand-in for writing descriptors
+    // directly into descriptor memory (VK_EXT_descriptor_buffer, not implemented as a backend):
+    // no allocation, only the descriptor update. A set can't be updated after it was bound into
+    // a command buffer that is still recording, so each bind of a run gets its own set. The sets
+    // come from their own pool because measure() resets descriptor_pool.
+    VkDescriptorPool persistent_pool;
+    std::vector<VkDescriptorSet> persistent_sets(bind_count);
+    {
+        VkDescriptorPoolSize pool_sizes[] = {
+            {VK_DESCRIPTOR_TYPE_SAMPLER,        bind_count},
+            {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,  bind_count},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,  bind_count},
+        };
+        VkDescriptorPoolCreateInfo create_info { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+        create_info.maxSets         = bind_count;
+        create_info.poolSizeCount   = (uint32_t)std::size(pool_sizes);
+        create_info.pPoolSizes      = pool_sizes;
+        VK_CHECK(vkCreateDescriptorPool(vk.device, &create_info, nullptr, &persistent_pool));
+
+        std::vector<VkDescriptorSetLayout> set_layouts(bind_count, set_layout);
+        VkDescriptorSetAllocateInfo alloc_info { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+        alloc_info.descriptorPool     = persistent_pool;
+        alloc_info.descriptorSetCount = bind_count;
+        alloc_info.pSetLayouts        = set_layouts.data();
+        VK_CHECK(vkAllocateDescriptorSets(vk.device, &alloc_info, persistent_sets.data()));
+    }
+
+    // A run records exactly bind_count binds and the command buffer is reset before the next run,
+    // so the sets are reused only after the command buffer that referenced them was reset.
+    uint32_t next_set = 0;
+
+    measure("vkUpdateDescriptorSets (preallocated set) + bind [stand-in]", [&](VkCommandBuffer cb) {
+        VkDescriptorSet set = persistent_sets[next_set++ % bind_count];
+        Descriptor_Writes(set)
+            .sampler        (0, sampler)
+            .sampled_image  (1, image.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+            .storage_image  (2, image.view);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &set, 0, nullptr);
+    });
+
+    next_set = 0;
+    measure("update template (preallocated set) + bind [stand-in]", [&](VkCommandBuffer cb) {
+        VkDescriptorSet set = persistent_sets[next_set++ % bind_count];
+        vkUpdateDescriptorSetWithTemplate(vk.device, set, set_template, template_data.infos);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &set, 0, nullptr);
+    });
+
+    if (vk.push_descriptors_supported) {
+        measure("vkCmdPushDescriptorSetKHR", [&](VkCommandBuffer cb) {
+            Descriptor_Writes(VK_NULL_HANDLE)
+                .sampler        (0, sampler)
+                .sampled_image  (1, image.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+                .storage_image  (2, image.view)
+                .push           (cb, VK_PIPELINE_BIND_POINT_COMPUTE, push_pipeline_layout, 0);
+        });
+
+        measure("vkCmdPushDescriptorSetWithTemplateKHR", [&](VkCommandBuffer cb) {
+            vkCmdPushDescriptorSetWithTemplateKHR(cb, push_template, push_pipeline_layout, 0, template_data.infos);
+        });
+    } else {
+        printf("VK_KHR_push_descriptor is not supported\n");
+    }
+
+    vkDestroyCommandPool(vk.device, command_pool, nullptr);
+    vkDestroyDescriptorPool(vk.device, persistent_pool, nullptr);
+    vkDestroyDescriptorPool(vk.device, descriptor_pool, nullptr);
+    vkDestroyDescriptorUpdateTemplate(vk.device, push_template, nullptr);
+    vkDestroyPipelineLayout(vk.device, push_pipeline_layout, nullptr);
+    vkDestroyDescriptorSetLayout(vk.device, push_set_layout, nullptr);
+    vkDestroyDescriptorUpdateTemplate(vk.device, set_template, nullptr);
+    vkDestroyPipelineLayout(vk.device, pipeline_layout, nullptr);
+    vkDestroyDescriptorSetLayout(vk.device, set_layout, nullptr);
+    vkDestroySampler(vk.device, sampler, nullptr);
+    image.destroy();
+}
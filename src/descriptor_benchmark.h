@@ -0,0 +1,5 @@
+#pragma once
+
+// Measures CPU cost of providing descriptors for a dispatch with descriptor sets, update
+// templates and push descriptors. Results are printed to stdout.
+void run_descriptor_bind_benchmark();
@@ -0,0 +1,34 @@
+#include "common.h"
+#include "dynamic_resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+void Dynamic_Resolution::update(float frame_time_ms, float scalable_time_ms) {
+    if (!enabled) {
+        scale = std::clamp(fixed_scale, min_scale, max_scale);
+        return;
+    }
+    if (scalable_time_ms <= 0.f)
+        return;
+
+    // Some headroom is left to absorb the variance of the frame time.
+    const float headroom = 0.9f;
+    const float fixed_time_ms = std::max(frame_time_ms - scalable_time_ms, 0.f);
+    const float scalable_budget_ms = std::max(target_frame_time_ms * headroom - fixed_time_ms, 0.1f * target_frame_time_ms);
+
+    // Scalable time is proportional to the pixel count, that is, to the square of the scale.
+    const float desired_scale = scale * std::sqrt(scalable_budget_ms / scalable_time_ms);
+
+    // Timings lag behind by the frames in flight. Decrease quickly to handle load spikes,
+    // increase slowly to not oscillate around the target.
+    const float rate = (desired_scale < scale) ? 0.5f : 0.05f;
+    scale = std::clamp(scale + (desired_scale - scale) * rate, min_scale, max_scale);
+}
+
+VkExtent2D Dynamic_Resolution::get_render_extent(VkExtent2D full_extent) const {
+    VkExtent2D extent;
+    extent.width = std::max(1u, (uint32_t)std::lround(full_extent.width * scale));
+    extent.height = std::max(1u, (uint32_t)std::lround(full_extent.height * scale));
+    return extent;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "vk.h"
+
+// Selects render resolution scale each frame to keep GPU frame time within the target.
+// The scene is rendered into the top-left sub-rectangle of the full size output image and
+// then upscaled to the swapchain, so changing the scale does not reallocate images.
+struct Dynamic_Resolution {
+    static constexpr float min_scale = 0.5f;
+    static constexpr float max_scale = 1.0f;
+
+    bool    enabled                 = false;
+    float   target_frame_time_ms    = 1000.f / 60.f;
+    float   fixed_scale             = max_scale; // used when dynamic scaling is disabled
+    float   scale                   = max_scale; // applied to each dimension
+
+    // frame_time_ms is GPU time of the frame, scalable_time_ms is the part of it
+    // that depends on render resolution.
+    void update(float frame_time_ms, float scalable_time_ms);
+
+    VkExtent2D get_render_extent(VkExtent2D full_extent) const;
+};
@@ -0,0 +1,81 @@
+#include "common.h"
+#include "file_watcher.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+void File_Watcher::initialize(const std::string& directory_) {
+    directory = directory_;
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1)
+        error("inotify_init1 failed");
+
+    // Editors either rewrite the file in place (IN_CLOSE_WRITE) or write a temporary file
+    // and rename it (IN_MOVED_TO). IN_MODIFY is not used because it fires on partial writes.
+    if (inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+        error("failed to watch directory: " + directory);
+}
+
+void File_Watcher::shutdown() {
+    if (inotify_fd != -1) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+}
+
+std::vector<std::string> File_Watcher::get_modified_files() {
+    std::vector<std::string> files;
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+        ssize_t size = read(inotify_fd, buffer, sizeof(buffer));
+        if (size <= 0)
+            break; // EAGAIN: no more events
+
+        for (char* ptr = buffer; ptr < buffer + size; ) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+            if (event->len > 0 && std::find(files.begin(), files.end(), event->name) == files.end())
+                files.push_back(event->name);
+            ptr += sizeof(inotify_event) + event->len;
+        }
+    }
+    return files;
+}
+
+#else
+void File_Watcher::initialize(const std::string& directory_) {
+    directory = directory_;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec))
+        write_times[entry.path().filename().string()] = entry.last_write_time(ec);
+}
+
+void File_Watcher::shutdown() {
+    write_times.clear();
+}
+
+std::vector<std::string> File_Watcher::get_modified_files() {
+    std::vector<std::string> files;
+    if (elapsed_milliseconds(last_poll_time) < 250)
+        return files;
+    last_poll_time = Timestamp();
+
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+        std::filesystem::file_time_type write_time = entry.last_write_time(ec);
+        if (ec)
+            continue;
+        auto& known_time = write_times[entry.path().filename().string()];
+        if (known_time != write_time) {
+            known_time = write_time;
+            files.push_back(entry.path().filename().string());
+        }
+    }
+    return files;
+}
+#endif
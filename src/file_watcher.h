@@ -0,0 +1,31 @@
+#pragma once
+
+#include "common.h"
+
+#include <string>
+#include <vector>
+
+#ifndef __linux__
+#include <filesystem>
+#include <unordered_map>
+#endif
+
+// Reports files that were modified in the directory (non-recursive). On Linux inotify is used,
+// on other platforms file modification times are polled.
+class File_Watcher {
+public:
+    void initialize(const std::string& directory);
+    void shutdown();
+
+    // Returns names of the files modified since the previous call. Does not block.
+    std::vector<std::string> get_modified_files();
+
+private:
+    std::string directory;
+#ifdef __linux__
+    int inotify_fd = -1;
+#else
+    std::unordered_map<std::string, std::filesystem::file_time_type> write_times;
+    Timestamp last_poll_time;
+#endif
+};
@@ -0,0 +1,61 @@
+#include "common.h"
+#include "cpu_profiler.h"
+#include "frame_pacer.h"
+#include "vk.h"
+
+#include <thread>
+
+namespace {
+const float influence = 0.25f; // smoothing of the measurements, as in GPU_Profiler
+
+// OS sleep can overshoot by the scheduler granularity, the last part of the wait is spun.
+const std::chrono::microseconds spin_margin(2000);
+}
+
+static void smooth(float& value, float new_value) {
+    value = (1.f - influence) * value + influence * new_value;
+}
+
+static void sleep_until_precise(std::chrono::steady_clock::time_point deadline) {
+    auto now = std::chrono::steady_clock::now();
+    if (deadline - now > spin_margin)
+        std::this_thread::sleep_for(deadline - now - spin_margin);
+    while (std::chrono::steady_clock::now() < deadline)
+        std::this_thread::yield();
+}
+
+void Frame_Pacer::wait_for_next_frame() {
+    Timestamp fence_wait_start;
+    vk_wait_for_frame();
+    smooth(fence_wait_ms, elapsed_microseconds(fence_wait_start) / 1000.f);
+
+    if (target_fps <= 0.f) {
+        limiter_wait_ms = 0.f;
+        return;
+    }
+
+    const auto frame_period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / target_fps));
+    const auto now = std::chrono::steady_clock::now();
+
+    // Deadlines advance by the frame period to keep the average rate. If the frame loop
+    // fell behind by more than a period, the schedule restarts from the current time.
+    frame_deadline += frame_period;
+    if (now - frame_deadline > frame_period)
+        frame_deadline = now;
+
+    CPU_TIME_SCOPE("frame_limiter");
+    Timestamp limiter_start;
+    sleep_until_precise(frame_deadline);
+    smooth(limiter_wait_ms, elapsed_microseconds(limiter_start) / 1000.f);
+}
+
+void Frame_Pacer::input_polled() {
+    input_time = Timestamp();
+    input_pending = true;
+}
+
+void Frame_Pacer::frame_submitted() {
+    if (input_pending)
+        smooth(input_to_submit_ms, elapsed_microseconds(input_time) / 1000.f);
+    input_pending = false;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+
+// Frame pacing for low input latency. The frame loop first waits for the frame fence, then
+// the limiter sleeps until the frame deadline, and only after that input is polled and the
+// camera is latched. Recording and submission follow immediately, so the frame is built from
+// the most recent input and the time blocked on the GPU is not part of the input latency.
+struct Frame_Pacer {
+    float       target_fps          = 0.f; // 0 disables the limiter
+
+    // Smoothed measurements.
+    float       fence_wait_ms       = 0.f; // CPU blocked on the frame fence
+    float       limiter_wait_ms     = 0.f; // CPU slept by the limiter
+    float       input_to_submit_ms  = 0.f; // from input polling to vkQueueSubmit/vkQueuePresentKHR return
+
+    // Waits until the frame slot is available and the limiter allows the next frame.
+    void wait_for_next_frame();
+
+    // Should be called right after input is polled.
+    void input_polled();
+
+    // Should be called after the frame is submitted.
+    void frame_submitted();
+
+private:
+    std::chrono::steady_clock::time_point   frame_deadline;
+    Timestamp                               input_time;
+    bool                                    input_pending = false;
+};
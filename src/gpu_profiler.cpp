@@ -0,0 +1,243 @@
+#include "common.h"
+#include "gpu_profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+
+GPU_Profiler gpu_profiler;
+
+namespace {
+const float influence = 0.25f; // smoothing of the measurements
+}
+
+void GPU_Profiler::shutdown() {
+    assert(open_scopes.empty());
+    for (Frame_Queries& frame : frames) {
+        for (VkQueryPool pool : frame.pools)
+            vkDestroyQueryPool(vk.device, pool, nullptr);
+        frame = Frame_Queries{};
+    }
+    nodes.clear();
+    top_level_nodes.clear();
+    frame_timings.clear();
+}
+
+void GPU_Profiler::begin_frame() {
+    static_assert(query_frame_count > sizeof(Vk_Instance::frame_fence) / sizeof(VkFence), "query frames are reused before their frames are finished");
+    assert(open_scopes.empty());
+
+    // Frames are checked from the oldest one, the first frame that is not finished stops the search.
+    for (uint32_t i = 1; i <= query_frame_count; i++) {
+        Frame_Queries& frame = frames[(current_frame + i) % query_frame_count];
+        if (!frame.pending)
+            continue;
+        if (!vk_is_frame_finished(frame.frame))
+            break;
+        read_frame_results(frame);
+        frame.pending = false;
+    }
+
+    current_frame = (current_frame + 1) % query_frame_count;
+    Frame_Queries& frame = frames[current_frame];
+    assert(!frame.pending);
+
+    // Pools are created here with one spare pool, since the command buffer can be inside a render pass
+    // when a scope begins and a new pool can't be reset there. Queries that did not fit are skipped.
+    const uint32_t required_pool_count = (max_query_count + queries_per_pool - 1) / queries_per_pool + 1;
+    while (frame.pools.size() < required_pool_count) {
+        VkQueryPoolCreateInfo create_info { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        create_info.queryCount = queries_per_pool;
+
+        VkQueryPool pool;
+        VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &pool));
+        frame.pools.push_back(pool);
+    }
+
+    // Reset happens outside of render passes, at the beginning of the frame's command buffer.
+    for (VkQueryPool pool : frame.pools)
+        vkCmdResetQueryPool(vk.command_buffer, pool, 0, queries_per_pool);
+    frame.query_count = 0;
+    requested_query_count = 0;
+    frame.scopes.clear();
+    frame.frame = vk.submitted_frame_count;
+    frame.pending = true;
+}
+
+void GPU_Profiler::read_frame_results(Frame_Queries& frame) {
+    const bool captured = frame.frame >= capture_first_frame && frame.frame < capture_end_frame;
+    if (captured)
+        captured_frame_count++;
+
+    if (frame.scopes.empty())
+        return;
+
+    // The frame is finished but the availability is still checked: VK_NOT_READY is not an error here,
+    // the scopes with missing timestamps are reported as unavailable.
+    timestamps.resize(2/*query_result + availability*/ * frame.query_count);
+    for (uint32_t first_query = 0; first_query < frame.query_count; first_query += queries_per_pool) {
+        uint32_t count = std::min(queries_per_pool, frame.query_count - first_query);
+        VkResult result = vkGetQueryPoolResults(vk.device, frame.pools[first_query / queries_per_pool], 0, count,
+            count * 2*sizeof(uint64_t), &timestamps[2*first_query], 2*sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        VK_CHECK_RESULT(result);
+    }
+
+    auto is_available = [this](const Scope_Record& scope) {
+        if (scope.start_query == invalid_query || scope.end_query == invalid_query)
+            return false;
+        return timestamps[2*scope.start_query + 1] != 0 && timestamps[2*scope.end_query + 1] != 0;
+    };
+
+    uint64_t frame_start = UINT64_MAX;
+    for (const Scope_Record& scope : frame.scopes) {
+        if (is_available(scope))
+            frame_start = std::min(frame_start, timestamps[2 * scope.start_query]);
+    }
+
+    frame_timings.clear();
+    timings_frame = frame.frame;
+    std::vector<float> frame_length_ms(nodes.size(), 0.f);
+    std::vector<bool> node_recorded(nodes.size(), false);
+    std::vector<bool> node_available(nodes.size(), true);
+
+    for (const Scope_Record& scope : frame.scopes) {
+        node_recorded[scope.node] = true;
+
+        GPU_Scope_Timing timing;
+        timing.node         = scope.node;
+        timing.depth        = nodes[scope.node].depth;
+        timing.available    = is_available(scope);
+
+        if (timing.available) {
+            uint64_t start = timestamps[2 * scope.start_query];
+            uint64_t end = timestamps[2 * scope.end_query];
+            assert(end >= start);
+            timing.start_ms     = float(double(start - frame_start) * vk.timestamp_period_ms);
+            timing.length_ms    = float(double(end - start) * vk.timestamp_period_ms);
+            frame_length_ms[scope.node] += timing.length_ms; // a scope can be recorded several times per frame
+
+            if (captured)
+                captured_scopes.push_back(GPU_Trace_Scope{scope.node, frame.frame, start, end});
+        } else {
+            timing.start_ms     = 0.f;
+            timing.length_ms    = 0.f;
+            node_available[scope.node] = false;
+            unavailable_scope_count++;
+        }
+        frame_timings.push_back(timing);
+    }
+
+    // Smoothed values are kept if the frame did not record the scope or has no valid measurement for it,
+    // so a skipped scope does not decay towards 0 (the values drive dynamic resolution).
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (node_recorded[i] && node_available[i])
+            nodes[i].length_ms = (1.f - influence) * nodes[i].length_ms + influence * frame_length_ms[i];
+    }
+}
+
+uint32_t GPU_Profiler::find_or_add_node(const char* name) {
+    const uint32_t parent = open_scopes.empty() ? invalid_node : frames[current_frame].scopes[open_scopes.back()].node;
+    std::vector<uint32_t>& siblings = (parent == invalid_node) ? top_level_nodes : nodes[parent].children;
+
+    for (uint32_t node : siblings) {
+        if (nodes[node].name == name)
+            return node;
+    }
+
+    GPU_Scope_Node node;
+    node.name       = name;
+    node.path       = (parent == invalid_node) ? node.name : nodes[parent].path + "/" + node.name;
+    node.parent     = parent;
+    node.depth      = (parent == invalid_node) ? 0 : nodes[parent].depth + 1;
+    node.length_ms  = 0.f;
+
+    const uint32_t node_index = (uint32_t)nodes.size();
+    siblings.push_back(node_index); // siblings can point into nodes, so it is updated before nodes grows
+    nodes.push_back(std::move(node));
+    return node_index;
+}
+
+uint32_t GPU_Profiler::write_timestamp(VkPipelineStageFlagBits stage) {
+    Frame_Queries& frame = frames[current_frame];
+    requested_query_count++;
+    max_query_count = std::max(max_query_count, requested_query_count);
+
+    // The pools grow in begin_frame of the next frames.
+    if (frame.query_count == frame.pools.size() * queries_per_pool)
+        return invalid_query;
+
+    const uint32_t query = frame.query_count++;
+    vkCmdWriteTimestamp(vk.command_buffer, stage, frame.pools[query / queries_per_pool], query % queries_per_pool);
+    return query;
+}
+
+void GPU_Profiler::begin_scope(const char* name) {
+    Scope_Record scope;
+    scope.node          = find_or_add_node(name);
+    scope.start_query   = write_timestamp(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+    scope.end_query     = 0;
+
+    Frame_Queries& frame = frames[current_frame];
+    open_scopes.push_back((uint32_t)frame.scopes.size());
+    frame.scopes.push_back(scope);
+}
+
+void GPU_Profiler::end_scope() {
+    assert(!open_scopes.empty());
+    Scope_Record& scope = frames[current_frame].scopes[open_scopes.back()];
+    open_scopes.pop_back();
+    scope.end_query = write_timestamp(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+}
+
+void GPU_Profiler::begin_capture(uint64_t first_frame, uint32_t frame_count) {
+    capture_first_frame = first_frame;
+    capture_end_frame = first_frame + frame_count;
+    captured_frame_count = 0;
+    captured_scopes.clear();
+}
+
+bool GPU_Profiler::is_capture_complete() const {
+    return captured_frame_count == capture_end_frame - capture_first_frame;
+}
+
+float GPU_Profiler::get_time_ms(const char* path) const {
+    for (const GPU_Scope_Node& node : nodes) {
+        if (node.path == path)
+            return node.length_ms;
+    }
+    return 0.f;
+}
+
+bool GPU_Profiler::save_frame_timings(const char* file_name) const {
+    std::ofstream file(file_name);
+    if (!file) {
+        printf("failed to write GPU timings: %s\n", file_name);
+        return false;
+    }
+
+    // frame_timings is in depth-first order, the depth of the next scope tells how many arrays to close.
+    file << "[";
+    for (size_t i = 0; i < frame_timings.size(); i++) {
+        const GPU_Scope_Timing& timing = frame_timings[i];
+        const uint32_t next_depth = (i + 1 < frame_timings.size()) ? frame_timings[i + 1].depth : 0;
+
+        file << "\n" << std::string(2 * (timing.depth + 1), ' ');
+        file << "{\"name\": \"" << nodes[timing.node].name << "\"";
+        if (timing.available)
+            file << ", \"start_ms\": " << timing.start_ms << ", \"length_ms\": " << timing.length_ms;
+        else
+            file << ", \"available\": false";
+        if (next_depth > timing.depth) {
+            file << ", \"children\": [";
+            continue;
+        }
+        file << "}";
+        for (uint32_t depth = timing.depth; depth > next_depth; depth--)
+            file << "\n" << std::string(2 * depth, ' ') << "]}";
+        if (i + 1 < frame_timings.size())
+            file << ",";
+    }
+    file << "\n]\n";
+    return true;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "vk.h"
+
+#include <string>
+#include <vector>
+
+// Hierarchical GPU timing. A scope is identified by its name and by the scopes that are open
+// when it begins: GPU_TIME_SCOPE("opaque") inside GPU_TIME_SCOPE("draw") has path "draw/opaque".
+// Timestamp queries are allocated while the frame is recorded from per-frame pools, so scopes are
+// not registered up front and can change from frame to frame. The pools grow in begin_frame to fit
+// the largest frame so far; scopes that do not fit into the current frame's pools are unavailable.
+//
+// The start timestamp is written at TOP_OF_PIPE and the end timestamp at BOTTOM_OF_PIPE, the
+// interval starts when the scope's commands can start executing and ends when all of them finished.
+//
+// Query pools form a ring of query_frame_count frames. Results are read without waiting, only after
+// vk_is_frame_finished reports that their frame is done, so they arrive with a latency of a few frames.
+struct GPU_Scope_Node {
+    std::string             name;
+    std::string             path;       // names of the enclosing scopes and of this scope separated by '/'
+    uint32_t                parent;     // GPU_Profiler::invalid_node for top-level scopes
+    uint32_t                depth;
+    std::vector<uint32_t>   children;
+    float                   length_ms;  // smoothed over the frames that recorded the scope
+};
+
+// Scope measured in a frame.
+struct GPU_Scope_Timing {
+    uint32_t    node;
+    uint32_t    depth;
+    float       start_ms;   // relative to the start of the first scope in the frame
+    float       length_ms;
+    bool        available;  // false if the driver did not provide the timestamps
+};
+
+// Raw timestamps of a scope from a captured frame.
+struct GPU_Trace_Scope {
+    uint32_t    node;
+    uint64_t    frame;              // vk.submitted_frame_count when the frame was recorded
+    uint64_t    start_timestamp;
+    uint64_t    end_timestamp;
+};
+
+struct GPU_Profiler {
+    static constexpr uint32_t invalid_node      = UINT32_MAX;
+    static constexpr uint32_t invalid_query     = UINT32_MAX;
+    static constexpr uint32_t queries_per_pool  = 64;
+    static constexpr uint32_t query_frame_count = 4; // should be more than the number of frames in flight
+
+    std::vector<GPU_Scope_Node>     nodes;
+    std::vector<GPU_Scope_Timing>   frame_timings; // most recent frame with results, in recording order (depth-first)
+    uint64_t                        timings_frame = 0; // frame_timings were recorded when vk.submitted_frame_count had this value
+    uint64_t                        unavailable_scope_count = 0; // scopes with unavailable results since the start
+
+    void shutdown();
+
+    // Reads the results of the finished frames and resets the queries for the new frame.
+    // Should be called after vk_begin_frame before any scope is recorded.
+    void begin_frame();
+
+    void begin_scope(const char* name);
+    void end_scope();
+
+    // Smoothed time of the scope with the given path, 0 if the scope was never recorded.
+    // Frames that do not record the scope keep the previous value.
+    float get_time_ms(const char* path) const;
+
+    // Writes frame_timings as a JSON tree.
+    bool save_frame_timings(const char* file_name) const;
+
+    // Collects raw timestamps of the frames [first_frame, first_frame + frame_count) into captured_scopes.
+    // The frames are identified by vk.submitted_frame_count. Unavailable scopes are not captured.
+    void begin_capture(uint64_t first_frame, uint32_t frame_count);
+    bool is_capture_complete() const; // results of all captured frames were read
+
+    std::vector<GPU_Trace_Scope>    captured_scopes;
+
+private:
+    struct Scope_Record {
+        uint32_t    node;
+        uint32_t    start_query;
+        uint32_t    end_query;
+    };
+
+    struct Frame_Queries {
+        std::vector<VkQueryPool>    pools;          // query i is in pools[i / queries_per_pool]
+        uint32_t                    query_count = 0; // queries written by the frame
+        std::vector<Scope_Record>   scopes;
+        uint64_t                    frame = 0;      // vk.submitted_frame_count when the frame was recorded
+        bool                        pending = false; // the results were not read yet
+    };
+
+    uint32_t find_or_add_node(const char* name);
+    uint32_t write_timestamp(VkPipelineStageFlagBits stage); // returns allocated query or invalid_query
+    void read_frame_results(Frame_Queries& frame);
+
+    Frame_Queries           frames[query_frame_count];
+    uint32_t                current_frame = 0;  // index in frames of the frame being recorded
+    std::vector<uint32_t>   open_scopes;        // indices in frames[current_frame].scopes
+    std::vector<uint32_t>   top_level_nodes;
+    std::vector<uint64_t>   timestamps;         // read back query results
+    uint32_t                requested_query_count = 0; // by the frame being recorded, including skipped ones
+    uint32_t                max_query_count = 0; // the most queries requested by a frame
+
+    uint64_t                capture_first_frame = 0;
+    uint64_t                capture_end_frame = 0;
+    uint64_t                captured_frame_count = 0;
+};
+
+extern GPU_Profiler gpu_profiler;
+
+struct GPU_Time_Scope {
+    GPU_Time_Scope(const char* name) {
+        gpu_profiler.begin_scope(name);
+    }
+    ~GPU_Time_Scope() {
+        gpu_profiler.end_scope();
+    }
+};
+
+#define GPU_TIME_SCOPE_CONCAT2(a, b) a##b
+#define GPU_TIME_SCOPE_CONCAT(a, b) GPU_TIME_SCOPE_CONCAT2(a, b)
+#define GPU_TIME_SCOPE(name) GPU_Time_Scope GPU_TIME_SCOPE_CONCAT(gpu_time_scope, __LINE__)(name)
@@ -0,0 +1,232 @@
+#include "common.h"
+#include "hi_z.h"
+#include "shader_manager.h"
+#include "utils.h"
+
+#include <algorithm>
+
+namespace {
+struct Push_Constants {
+    uint32_t depth_size[2];
+    uint32_t hi_z_size[2];
+    uint32_t level_count;
+    uint32_t group_count;
+};
+
+const uint32_t tile_size = 32; // level 0 texels processed by one workgroup, see hi_z_downsample.comp.glsl
+const uint32_t tile_level_count = 6; // levels computed by each workgroup, the last workgroup computes the rest
+}
+
+static VkImageSubresourceRange get_depth_subresource_range() {
+    VkImageSubresourceRange range{};
+    range.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (vk.depth_info.has_stencil)
+        range.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    range.levelCount = 1;
+    range.layerCount = 1;
+    return range;
+}
+
+static uint32_t floor_power_of_two(uint32_t n) {
+    uint32_t p = 1;
+    while (p * 2 <= n)
+        p *= 2;
+    return p;
+}
+
+void Hi_Z_Pyramid::create() {
+    set_layout = Descriptor_Set_Layout()
+        .sampler            (0, VK_SHADER_STAGE_COMPUTE_BIT)
+        .sampled_image      (1, VK_SHADER_STAGE_COMPUTE_BIT)
+        .storage_image_array(2, max_level_count, VK_SHADER_STAGE_COMPUTE_BIT)
+        .storage_buffer     (3, VK_SHADER_STAGE_COMPUTE_BIT)
+        .create             ("hi_z_set_layout");
+
+    // pipeline layout
+    {
+        VkPushConstantRange range;
+        range.stageFlags    = VK_SHADER_STAGE_COMPUTE_BIT;
+        range.offset        = 0;
+        range.size          = sizeof(Push_Constants);
+
+        VkPipelineLayoutCreateInfo create_info { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+        create_info.setLayoutCount          = 1;
+        create_info.pSetLayouts             = &set_layout;
+        create_info.pushConstantRangeCount  = 1;
+        create_info.pPushConstantRanges     = &range;
+
+        VK_CHECK(vkCreatePipelineLayout(vk.device, &create_info, nullptr, &pipeline_layout));
+        vk_set_debug_name(pipeline_layout, "hi_z_pipeline_layout");
+    }
+
+    // pipeline
+    {
+        VkShaderModule downsample_shader = load_shader("hi_z_downsample.comp.glsl");
+        pipeline = vk_create_compute_pipeline(pipeline_layout, downsample_shader, nullptr, "hi_z_downsample_pipeline");
+        vkDestroyShaderModule(vk.device, downsample_shader, nullptr);
+    }
+
+    // point sampler
+    {
+        VkSamplerCreateInfo create_info { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+        create_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        create_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        create_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        create_info.maxLod = VK_LOD_CLAMP_NONE;
+        VK_CHECK(vkCreateSampler(vk.device, &create_info, nullptr, &point_sampler));
+        vk_set_debug_name(point_sampler, "hi_z_point_sampler");
+    }
+
+    // The last workgroup resets the counter, so it's cleared only once.
+    counter_buffer = vk_create_buffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, "hi_z_counter_buffer");
+    vk_execute(vk.command_pools[0], vk.queue, [this](VkCommandBuffer command_buffer) {
+        vkCmdFillBuffer(command_buffer, counter_buffer.handle, 0, sizeof(uint32_t), 0);
+    });
+}
+
+void Hi_Z_Pyramid::destroy() {
+    vkDestroyDescriptorSetLayout(vk.device, set_layout, nullptr);
+    vkDestroyPipelineLayout(vk.device, pipeline_layout, nullptr);
+    vkDestroyPipeline(vk.device, pipeline, nullptr);
+    vkDestroySampler(vk.device, point_sampler, nullptr);
+    counter_buffer.destroy();
+}
+
+void Hi_Z_Pyramid::create_resolution_dependent_resources(uint32_t depth_width, uint32_t depth_height, VkImageView depth_view) {
+    this->depth_width = depth_width;
+    this->depth_height = depth_height;
+    this->depth_view = depth_view;
+
+    width = std::min(floor_power_of_two(depth_width), 1u << (max_level_count - 1));
+    height = std::min(floor_power_of_two(depth_height), 1u << (max_level_count - 1));
+    level_count = 1;
+    while ((std::max(width, height) >> level_count) > 0)
+        level_count++;
+
+    // image
+    {
+        VkImageCreateInfo create_info { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+        create_info.imageType       = VK_IMAGE_TYPE_2D;
+        create_info.format          = VK_FORMAT_R32_SFLOAT;
+        create_info.extent.width    = width;
+        create_info.extent.height   = height;
+        create_info.extent.depth    = 1;
+        create_info.mipLevels       = level_count;
+        create_info.arrayLayers     = 1;
+        create_info.samples         = VK_SAMPLE_COUNT_1_BIT;
+        create_info.tiling          = VK_IMAGE_TILING_OPTIMAL;
+        create_info.usage           = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        create_info.sharingMode     = VK_SHARING_MODE_EXCLUSIVE;
+        create_info.initialLayout   = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VmaAllocationCreateInfo alloc_create_info{};
+        alloc_create_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+        VK_CHECK(vmaCreateImage(vk.allocator, &create_info, &alloc_create_info, &image.handle, &image.allocation, nullptr));
+        vk_set_debug_name(image.handle, "hi_z_image");
+    }
+
+    // views
+    {
+        VkImageViewCreateInfo create_info { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+        create_info.image                           = image.handle;
+        create_info.viewType                        = VK_IMAGE_VIEW_TYPE_2D;
+        create_info.format                          = VK_FORMAT_R32_SFLOAT;
+        create_info.subresourceRange.aspectMask     = VK_IMAGE_ASPECT_COLOR_BIT;
+        create_info.subresourceRange.levelCount     = level_count;
+        create_info.subresourceRange.layerCount     = 1;
+        VK_CHECK(vkCreateImageView(vk.device, &create_info, nullptr, &image.view));
+
+        for (uint32_t i = 0; i < level_count; i++) {
+            create_info.subresourceRange.baseMipLevel   = i;
+            create_info.subresourceRange.levelCount     = 1;
+            VK_CHECK(vkCreateImageView(vk.device, &create_info, nullptr, &level_views[i]));
+        }
+    }
+
+    image_initialized = false;
+}
+
+void Hi_Z_Pyramid::release_resolution_dependent_resources() {
+    for (uint32_t i = 0; i < level_count; i++)
+        vk_destroy_deferred(level_views[i]);
+    level_count = 0;
+    vk_destroy_deferred(image);
+}
+
+void Hi_Z_Pyramid::initialize_image_layout(VkCommandBuffer command_buffer) {
+    if (image_initialized)
+        return;
+
+    VkImageSubresourceRange subresource_range{};
+    subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    subresource_range.levelCount = level_count;
+    subresource_range.layerCount = 1;
+
+    vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, subresource_range,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 0,
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    image_initialized = true;
+}
+
+void Hi_Z_Pyramid::build(VkCommandBuffer command_buffer, VkImage depth_image, VkExtent2D render_extent) {
+    GPU_MARKER_SCOPE(command_buffer, "build_hi_z");
+
+    const VkImageSubresourceRange depth_range = get_depth_subresource_range();
+
+    VkImageSubresourceRange hi_z_range{};
+    hi_z_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    hi_z_range.levelCount = level_count;
+    hi_z_range.layerCount = 1;
+
+    vk_cmd_image_barrier_for_subresource(command_buffer, depth_image, depth_range,
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,       VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,   VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+
+    // The pyramid of the previous frame might be still read by the culling pass.
+    vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, hi_z_range,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT,              VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_GENERAL,                VK_IMAGE_LAYOUT_GENERAL);
+
+    const uint32_t group_count_x = (width + tile_size - 1) / tile_size;
+    const uint32_t group_count_y = (height + tile_size - 1) / tile_size;
+
+    Push_Constants push_constants;
+    push_constants.depth_size[0]    = std::min(render_extent.width, depth_width);
+    push_constants.depth_size[1]    = std::min(render_extent.height, depth_height);
+    push_constants.hi_z_size[0]     = width;
+    push_constants.hi_z_size[1]     = height;
+    push_constants.level_count      = level_count;
+    push_constants.group_count      = group_count_x * group_count_y;
+
+    // The set is allocated per frame, so the views of the retired pyramid are not referenced after resize.
+    // Unused array elements point to the last level, all descriptors of the array must be valid.
+    VkDescriptorSet descriptor_set = vk.frame_descriptor_allocator->allocate(set_layout);
+    {
+        Descriptor_Writes writes(descriptor_set);
+        writes
+            .sampler        (0, point_sampler)
+            .sampled_image  (1, depth_view, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL)
+            .storage_buffer (3, counter_buffer.handle, 0, sizeof(uint32_t));
+        for (uint32_t i = 0; i < max_level_count; i++)
+            writes.storage_image(2, i, level_views[std::min(i, level_count - 1)]);
+    }
+
+    vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &descriptor_set, 0, nullptr);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdDispatch(command_buffer, group_count_x, group_count_y, 1);
+
+    vk_cmd_image_barrier_for_subresource(command_buffer, image.handle, hi_z_range,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_WRITE_BIT,             VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_GENERAL,                VK_IMAGE_LAYOUT_GENERAL);
+
+    vk_cmd_image_barrier_for_subresource(command_buffer, depth_image, depth_range,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,               VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+        0,                                                  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+}
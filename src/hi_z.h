@@ -0,0 +1,43 @@
+#pragma once
+
+#include "vk.h"
+
+// Hierarchical-Z pyramid built from the depth buffer by a single-pass compute downsampler.
+// A texel stores the farthest depth of the screen area it covers, so an object that is farther
+// than all pyramid texels it overlaps is occluded. Level 0 has the largest power-of-two size
+// that fits into the depth buffer, the last level is 1x1. Requires vk.storage_image_array_indexing_supported.
+struct Hi_Z_Pyramid {
+    static constexpr uint32_t max_level_count = 13; // 4096x4096 level 0
+
+    VkDescriptorSetLayout           set_layout;
+    VkPipelineLayout                pipeline_layout;
+    VkPipeline                      pipeline;
+    VkSampler                       point_sampler;
+    Vk_Buffer                       counter_buffer; // workgroups that finished the first levels
+
+    Vk_Image                        image; // R32_SFLOAT, GENERAL layout, view contains all levels
+    VkImageView                     level_views[max_level_count];
+    uint32_t                        width;
+    uint32_t                        height;
+    uint32_t                        level_count;
+    uint32_t                        depth_width;
+    uint32_t                        depth_height;
+    VkImageView                     depth_view;
+    bool                            image_initialized; // false until the image is transitioned to GENERAL layout
+
+    void create();
+    void destroy();
+    // depth_view is VK_NULL_HANDLE for transient depth, build() can't be called in that case.
+    void create_resolution_dependent_resources(uint32_t depth_width, uint32_t depth_height, VkImageView depth_view);
+    // The resources are destroyed when the frames that use them are finished.
+    void release_resolution_dependent_resources();
+
+    // Transitions the new image to GENERAL layout. Should be called each frame before the pyramid is
+    // accessed, only the first call after create_resolution_dependent_resources records the barrier.
+    void initialize_image_layout(VkCommandBuffer command_buffer);
+
+    // Depth image should be in DEPTH_STENCIL_ATTACHMENT_OPTIMAL layout and is returned to it.
+    // The pyramid can be read by compute shaders after this call. Level 0 covers the top-left
+    // render_extent area of the depth image.
+    void build(VkCommandBuffer command_buffer, VkImage depth_image, VkExtent2D render_extent);
+};
@@ -0,0 +1,216 @@
+#include "common.h"
+#include "instance_culling.h"
+#include "shader_manager.h"
+#include "utils.h"
+
+#include <cstring>
+
+namespace {
+struct Cull_Uniforms {
+    Matrix4x4   view_proj;
+    Vector4     frustum_planes[6];
+    Vector4     bounding_sphere;
+    uint32_t    instance_count;
+    uint32_t    index_count;
+    uint32_t    hi_z_size[2];
+    uint32_t    hi_z_level_count;
+};
+
+const uint32_t group_size = 64; // local_size_x in cull_instances.comp.glsl
+}
+
+static void cmd_memory_barrier(VkCommandBuffer command_buffer,
+    VkPipelineStageFlags src_stage_mask, VkPipelineStageFlags dst_stage_mask,
+    VkAccessFlags src_access_mask, VkAccessFlags dst_access_mask)
+{
+    VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = src_access_mask;
+    barrier.dstAccessMask = dst_access_mask;
+    vkCmdPipelineBarrier(command_buffer, src_stage_mask, dst_stage_mask, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void Instance_Culling::create(const Uniform_Allocator& uniform_allocator) {
+    set_layout = Descriptor_Set_Layout()
+        .uniform_buffer_dynamic(0, VK_SHADER_STAGE_COMPUTE_BIT)
+        .storage_buffer (1, VK_SHADER_STAGE_COMPUTE_BIT)
+        .storage_buffer (2, VK_SHADER_STAGE_COMPUTE_BIT)
+        .storage_buffer (3, VK_SHADER_STAGE_COMPUTE_BIT)
+        .storage_buffer (4, VK_SHADER_STAGE_COMPUTE_BIT)
+        .create         ("instance_culling_set_layout");
+
+    hi_z_set_layout = Descriptor_Set_Layout()
+        .sampler        (0, VK_SHADER_STAGE_COMPUTE_BIT)
+        .sampled_image  (1, VK_SHADER_STAGE_COMPUTE_BIT)
+        .create         ("instance_culling_hi_z_set_layout");
+
+    // pipeline layout
+    {
+        VkPushConstantRange range;
+        range.stageFlags    = VK_SHADER_STAGE_COMPUTE_BIT;
+        range.offset        = 0;
+        range.size          = sizeof(uint32_t); // Cull_Phase
+
+        VkDescriptorSetLayout set_layouts[] = {set_layout, hi_z_set_layout};
+
+        VkPipelineLayoutCreateInfo create_info { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+        create_info.setLayoutCount          = (uint32_t)std::size(set_layouts);
+        create_info.pSetLayouts             = set_layouts;
+        create_info.pushConstantRangeCount  = 1;
+        create_info.pPushConstantRanges     = &range;
+
+        VK_CHECK(vkCreatePipelineLayout(vk.device, &create_info, nullptr, &pipeline_layout));
+        vk_set_debug_name(pipeline_layout, "instance_culling_pipeline_layout");
+    }
+
+    // pipeline
+    {
+        VkShaderModule cull_shader = load_shader("cull_instances.comp.glsl");
+        pipeline = vk_create_compute_pipeline(pipeline_layout, cull_shader, nullptr, "cull_instances_pipeline");
+        vkDestroyShaderModule(vk.device, cull_shader, nullptr);
+    }
+
+    draw_count_buffer = vk_create_buffer(sizeof(Cull_Stats),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        "draw_count_buffer");
+
+    void* ptr;
+    readback_buffer = vk_create_host_visible_buffer(std::size(vk.frame_fence) * sizeof(Cull_Stats), VK_BUFFER_USAGE_TRANSFER_DST_BIT, &ptr, "cull_stats_readback_buffer");
+    mapped_readback = static_cast<Cull_Stats*>(ptr);
+    memset(mapped_readback, 0, std::size(vk.frame_fence) * sizeof(Cull_Stats));
+
+    // Descriptor set is allocated by update_instance_buffer.
+    uniform_buffer = uniform_allocator.buffer.handle;
+    instance_count = 0;
+    stats = Cull_Stats{};
+}
+
+void Instance_Culling::destroy() {
+    vkDestroyDescriptorSetLayout(vk.device, set_layout, nullptr);
+    vkDestroyDescriptorSetLayout(vk.device, hi_z_set_layout, nullptr);
+    vkDestroyPipelineLayout(vk.device, pipeline_layout, nullptr);
+    vkDestroyPipeline(vk.device, pipeline, nullptr);
+    draw_command_buffer.destroy();
+    draw_count_buffer.destroy();
+    visibility_buffer.destroy();
+    readback_buffer.destroy();
+}
+
+void Instance_Culling::update_instance_buffer(VkBuffer instance_buffer, uint32_t instance_count) {
+    this->instance_count = instance_count;
+
+    if (draw_command_buffer.handle != VK_NULL_HANDLE) {
+        vk_destroy_deferred(draw_command_buffer);
+        vk_destroy_deferred(visibility_buffer);
+        vk_destroy_deferred(vk.descriptor_allocator, set_layout, descriptor_set);
+    }
+
+    const VkDeviceSize commands_size = 2 * instance_count * sizeof(VkDrawIndexedIndirectCommand);
+    draw_command_buffer = vk_create_buffer(commands_size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        "draw_command_buffer");
+
+    const VkDeviceSize visibility_size = instance_count * sizeof(uint32_t);
+    visibility_buffer = vk_create_buffer(visibility_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, "visibility_buffer");
+    visibility_buffer_cleared = false; // cleared by the next cull
+
+    descriptor_set = vk.descriptor_allocator.allocate(set_layout);
+    Descriptor_Writes(descriptor_set)
+        .uniform_buffer_dynamic(0, uniform_buffer, sizeof(Cull_Uniforms))
+        .storage_buffer (1, instance_buffer, 0, VK_WHOLE_SIZE)
+        .storage_buffer (2, draw_command_buffer.handle, 0, commands_size)
+        .storage_buffer (3, draw_count_buffer.handle, 0, sizeof(Cull_Stats))
+        .storage_buffer (4, visibility_buffer.handle, 0, visibility_size);
+}
+
+void Instance_Culling::update_hi_z(VkImageView hi_z_view, VkSampler point_sampler, uint32_t width, uint32_t height, uint32_t level_count) {
+    hi_z_size[0] = width;
+    hi_z_size[1] = height;
+    hi_z_level_count = level_count;
+    this->hi_z_view = hi_z_view;
+    hi_z_sampler = point_sampler;
+}
+
+void Instance_Culling::cull(VkCommandBuffer command_buffer, Uniform_Allocator& uniform_allocator, Cull_Phase phase,
+    const Matrix4x4& view_proj, Vector3 bounding_sphere_center, float bounding_sphere_radius, uint32_t index_count)
+{
+    const bool first_pass = (phase != Cull_Phase::occlusion_second_pass);
+    const bool last_pass = (phase != Cull_Phase::occlusion_first_pass);
+
+    // The frame fence of this frame slot is signaled, so the stats written by that frame are available.
+    if (first_pass)
+        stats = mapped_readback[vk.frame_index];
+
+    uint32_t uniform_offset;
+    Cull_Uniforms* uniforms = uniform_allocator.allocate<Cull_Uniforms>(&uniform_offset);
+    uniforms->view_proj = view_proj;
+    get_frustum_planes(view_proj, uniforms->frustum_planes);
+    uniforms->bounding_sphere   = Vector4(bounding_sphere_center.x, bounding_sphere_center.y, bounding_sphere_center.z, bounding_sphere_radius);
+    uniforms->instance_count    = instance_count;
+    uniforms->index_count       = index_count;
+    uniforms->hi_z_size[0]      = hi_z_size[0];
+    uniforms->hi_z_size[1]      = hi_z_size[1];
+    uniforms->hi_z_level_count  = hi_z_level_count;
+
+    const VkDeviceSize commands_offset = first_pass ? 0 : instance_count * sizeof(VkDrawIndexedIndirectCommand);
+    const VkDeviceSize commands_size = instance_count * sizeof(VkDrawIndexedIndirectCommand);
+
+    // The previous frame might still read the draw commands.
+    cmd_memory_barrier(command_buffer,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,    VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0,                                      0);
+
+    // Without the count buffer all commands are drawn, the ones that are not written must be empty.
+    if (!vk.draw_indirect_count_supported)
+        vkCmdFillBuffer(command_buffer, draw_command_buffer.handle, commands_offset, commands_size, 0);
+    if (first_pass)
+        vkCmdFillBuffer(command_buffer, draw_count_buffer.handle, 0, sizeof(Cull_Stats), 0);
+    if (first_pass && !visibility_buffer_cleared) {
+        vkCmdFillBuffer(command_buffer, visibility_buffer.handle, 0, VK_WHOLE_SIZE, 0);
+        visibility_buffer_cleared = true;
+    }
+
+    cmd_memory_barrier(command_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT,           VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    // Hi-Z set is allocated per frame, so the pyramid can be recreated while the previous frames still read the old one.
+    VkDescriptorSet hi_z_set = vk.frame_descriptor_allocator->allocate(hi_z_set_layout);
+    Descriptor_Writes(hi_z_set)
+        .sampler        (0, hi_z_sampler)
+        .sampled_image  (1, hi_z_view, VK_IMAGE_LAYOUT_GENERAL);
+
+    VkDescriptorSet sets[] = {descriptor_set, hi_z_set};
+    vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &phase);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, (uint32_t)std::size(sets), sets, 1, &uniform_offset);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdDispatch(command_buffer, (instance_count + group_size - 1) / group_size, 1, 1);
+
+    cmd_memory_barrier(command_buffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,   VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_WRITE_BIT,             VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    if (last_pass) {
+        VkBufferCopy region;
+        region.srcOffset    = 0;
+        region.dstOffset    = vk.frame_index * sizeof(Cull_Stats);
+        region.size         = sizeof(Cull_Stats);
+        vkCmdCopyBuffer(command_buffer, draw_count_buffer.handle, readback_buffer.handle, 1, &region);
+
+        cmd_memory_barrier(command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,     VK_PIPELINE_STAGE_HOST_BIT,
+            VK_ACCESS_TRANSFER_WRITE_BIT,       VK_ACCESS_HOST_READ_BIT);
+    }
+}
+
+void Instance_Culling::draw(VkCommandBuffer command_buffer, Cull_Phase phase) {
+    const bool first_pass = (phase != Cull_Phase::occlusion_second_pass);
+    const VkDeviceSize commands_offset = first_pass ? 0 : instance_count * sizeof(VkDrawIndexedIndirectCommand);
+    const VkDeviceSize count_offset = first_pass ? offsetof(Cull_Stats, first_pass_draw_count) : offsetof(Cull_Stats, second_pass_draw_count);
+
+    if (vk.draw_indirect_count_supported) {
+        vkCmdDrawIndexedIndirectCountKHR(command_buffer, draw_command_buffer.handle, commands_offset, draw_count_buffer.handle, count_offset,
+            instance_count, sizeof(VkDrawIndexedIndirectCommand));
+    } else {
+        vkCmdDrawIndexedIndirect(command_buffer, draw_command_buffer.handle, commands_offset, instance_count, sizeof(VkDrawIndexedIndirectCommand));
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "matrix.h"
+#include "uniform_allocator.h"
+#include "vk.h"
+
+// Culling passes of a frame. Frustum culling uses one pass. Occlusion culling uses two passes:
+// the first one draws instances that were visible in the previous frame, then the Hi-Z pyramid
+// is built from their depth and the second pass draws instances that became visible.
+enum class Cull_Phase : uint32_t {
+    frustum,
+    occlusion_first_pass,
+    occlusion_second_pass
+};
+
+// Culling results of the last finished frame.
+struct Cull_Stats {
+    uint32_t first_pass_draw_count;
+    uint32_t second_pass_draw_count;
+    uint32_t frustum_visible_count;
+    uint32_t occluded_count; // frustum visible instances rejected by Hi-Z test
+};
+
+// GPU culling of mesh instances. The compute pass tests the bounding sphere of each instance
+// against the frustum planes and optionally against Hi-Z pyramid, and writes a compacted
+// VkDrawIndexedIndirectCommand per visible instance plus the draw count, so the CPU cost of
+// the draw does not depend on the instance count. Requires vk.multi_draw_indirect_supported.
+// Without VK_KHR_draw_indirect_count the command buffer is cleared every frame and all
+// instance_count commands are drawn.
+struct Instance_Culling {
+    VkDescriptorSetLayout           set_layout;
+    VkDescriptorSetLayout           hi_z_set_layout; // set 1, allocated per frame
+    VkPipelineLayout                pipeline_layout;
+    VkPipeline                      pipeline;
+    VkDescriptorSet                 descriptor_set;
+    VkBuffer                        uniform_buffer;
+    Vk_Buffer                       draw_command_buffer; // commands of the first and the second pass
+    Vk_Buffer                       draw_count_buffer; // Cull_Stats
+    Vk_Buffer                       visibility_buffer; // per instance, 1 if visible in the previous frame
+    bool                            visibility_buffer_cleared; // the clear of the new buffer is recorded
+    Vk_Buffer                       readback_buffer; // Cull_Stats of each frame in flight
+    Cull_Stats*                     mapped_readback;
+    uint32_t                        instance_count;
+    VkImageView                     hi_z_view;
+    VkSampler                       hi_z_sampler;
+    uint32_t                        hi_z_size[2];
+    uint32_t                        hi_z_level_count;
+    Cull_Stats                      stats; // from the last finished frame
+
+    void create(const Uniform_Allocator& uniform_allocator);
+    void destroy();
+
+    // The previous buffers and descriptor set are retired with vk_destroy_deferred. The new
+    // visibility buffer is cleared by the next cull call in the frame command buffer.
+    void update_instance_buffer(VkBuffer instance_buffer, uint32_t instance_count);
+
+    // The previous Hi-Z pyramid can be still in use by the frames in flight.
+    void update_hi_z(VkImageView hi_z_view, VkSampler point_sampler, uint32_t width, uint32_t height, uint32_t level_count);
+
+    // Records culling dispatch. Should be called outside of the render pass. The bounding sphere
+    // is specified with the model transform applied. The second occlusion pass reads Hi-Z pyramid.
+    void cull(VkCommandBuffer command_buffer, Uniform_Allocator& uniform_allocator, Cull_Phase phase,
+        const Matrix4x4& view_proj, Vector3 bounding_sphere_center, float bounding_sphere_radius, uint32_t index_count);
+
+    // Draws instances selected by the culling pass with the currently bound pipeline and buffers.
+    void draw(VkCommandBuffer command_buffer, Cull_Phase phase);
+};
@@ -1,13 +1,10 @@
 #include "demo.h"
-#include "platform.h"
 
 #include "glfw/glfw3.h"
 
+#include <algorithm>
 #include <cassert>
-
-struct Command_Line_Options {
-    bool enable_validation_layers;
-};
+#include <cstdlib>
 
 static bool parse_command_line(int argc, char** argv, Command_Line_Options& options) {
     bool found_unknown_option = false;
@@ -15,6 +12,88 @@ static bool parse_command_line(int argc, char** argv, Command_Line_Options& opti
         if (strcmp(argv[i], "--validation-layers") == 0) {
             options.enable_validation_layers = true;
         }
+        else if (strcmp(argv[i], "--tune-workgroups") == 0) {
+            options.tune_workgroup_sizes = true;
+        }
+        else if (strcmp(argv[i], "--benchmark-descriptors") == 0) {
+            options.benchmark_descriptors = true;
+        }
+        else if (strcmp(argv[i], "--benchmark-instancing") == 0) {
+            options.benchmark_instancing = true;
+        }
+        else if (strcmp(argv[i], "--transient-depth") == 0) {
+            options.transient_depth = true;
+        }
+        else if (strcmp(argv[i], "--descriptor-backend") == 0) {
+            if (i == argc-1) {
+                printf("--descriptor-backend value is missing\n");
+            } else if (strcmp(argv[i+1], "sets") == 0) {
+                options.descriptor_backend = Descriptor_Backend::descriptor_sets;
+                i++;
+            } else if (strcmp(argv[i+1], "push") == 0) {
+                options.descriptor_backend = Descriptor_Backend::push_descriptors;
+                i++;
+            } else {
+                printf("unknown --descriptor-backend value: %s\n", argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--render-scale") == 0) {
+            if (i == argc-1) {
+                printf("--render-scale value is missing\n");
+            } else {
+                options.render_scale = std::clamp((float)atof(argv[i+1]), Dynamic_Resolution::min_scale, Dynamic_Resolution::max_scale);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--upscale-filter") == 0) {
+            if (i == argc-1) {
+                printf("--upscale-filter value is missing\n");
+            } else if (strcmp(argv[i+1], "bilinear") == 0) {
+                options.upscale_filter = Upscale_Filter::bilinear;
+                i++;
+            } else if (strcmp(argv[i+1], "edge-adaptive") == 0) {
+                options.upscale_filter = Upscale_Filter::edge_adaptive;
+                i++;
+            } else {
+                printf("unknown --upscale-filter value: %s\n", argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--sharpness") == 0) {
+            if (i == argc-1) {
+                printf("--sharpness value is missing\n");
+            } else {
+                options.sharpness = std::clamp((float)atof(argv[i+1]), 0.f, 1.f);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--target-fps") == 0) {
+            if (i == argc-1) {
+                printf("--target-fps value is missing\n");
+            } else {
+                options.target_fps = std::max((float)atof(argv[i+1]), 0.f);
+                i++;
+            }
+        }
+        else if (strcmp(argv[i], "--render-on-demand") == 0) {
+            options.render_on_demand = true;
+        }
+        else if (strcmp(argv[i], "--compile-shaders") == 0) {
+            options.compile_shaders = true;
+        }
+        else if (strcmp(argv[i], "--hot-reload") == 0) {
+            options.compile_shaders = true;
+            options.shader_hot_reload = true;
+        }
+        else if (strcmp(argv[i], "--shader-dir") == 0) {
+            if (i == argc-1) {
+                printf("--shader-dir value is missing\n");
+            } else {
+                options.shader_dir = argv[i+1];
+                i++;
+            }
+        }
         else if (strcmp(argv[i], "--data-dir") == 0) {
             if (i == argc-1) {
                 printf("--data-dir value is missing\n");
@@ -28,6 +107,19 @@ static bool parse_command_line(int argc, char** argv, Command_Line_Options& opti
             printf("%-25s Path to the data directory. Default is ./data.\n", "--data-dir");
             printf("%-25s Enables Vulkan validation layers.\n", "--validation-layers");
             printf("%-25s Allows to assign debug names to Vulkan objects.\n", "--debug-names");
+            printf("%-25s Measures CPU cost of descriptor sets, update templates and push descriptors.\n", "--benchmark-descriptors");
+            printf("%-25s Measures GPU time of one instanced draw and of a draw per instance, up to 1M instances.\n", "--benchmark-instancing");
+            printf("%-25s Uses transient lazily allocated depth buffer. Disables Hi-Z occlusion culling.\n", "--transient-depth");
+            printf("%-25s Selects how per-frame descriptors are provided: sets or push. Default is push.\n", "--descriptor-backend");
+            printf("%-25s Internal render resolution relative to the window size, 0.5 to 1.0. Default is 1.0.\n", "--render-scale");
+            printf("%-25s Filter that upscales internal resolution: bilinear or edge-adaptive. Default is edge-adaptive.\n", "--upscale-filter");
+            printf("%-25s Contrast adaptive sharpening strength, 0 to 1. Default is 0 (disabled).\n", "--sharpness");
+            printf("%-25s Frame rate limit, the frame loop sleeps until the next frame deadline. Default is 0 (no limit).\n", "--target-fps");
+            printf("%-25s Renders only when input, animation or window state changes, otherwise waits for events.\n", "--render-on-demand");
+            printf("%-25s Compiles GLSL shaders at runtime and caches SPIR-V in data/spirv_cache.\n", "--compile-shaders");
+            printf("%-25s Recompiles shaders and rebuilds pipelines when shader files change. Implies --compile-shaders.\n", "--hot-reload");
+            printf("%-25s Path to the GLSL shader sources. Default is ./src/shaders.\n", "--shader-dir");
+            printf("%-25s Benchmarks compute workgroup sizes and caches the best ones for this device.\n", "--tune-workgroups");
             printf("%-25s Shows this information.\n", "--help");
             return false;
         }
@@ -39,10 +131,23 @@ static bool parse_command_line(int argc, char** argv, Command_Line_Options& opti
     return true;
 }
 
+// Set by the window event callbacks, the demo renders new frames after events in render-on-demand mode.
+static bool window_events_received;
+
+static void install_window_event_callbacks(GLFWwindow* window) {
+    glfwSetCursorPosCallback(window, [](GLFWwindow*, double, double) { window_events_received = true; });
+    glfwSetMouseButtonCallback(window, [](GLFWwindow*, int, int, int) { window_events_received = true; });
+    glfwSetScrollCallback(window, [](GLFWwindow*, double, double) { window_events_received = true; });
+    glfwSetCharCallback(window, [](GLFWwindow*, unsigned int) { window_events_received = true; });
+    glfwSetWindowFocusCallback(window, [](GLFWwindow*, int) { window_events_received = true; });
+    glfwSetWindowRefreshCallback(window, [](GLFWwindow*) { window_events_received = true; });
+}
+
 static int window_width = 720;
 static int window_height = 720;
 
 static void glfw_key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    window_events_received = true;
     if (action == GLFW_PRESS) {
         if (key == GLFW_KEY_ESCAPE) {
             glfwSetWindowShouldClose(window, GLFW_TRUE);
@@ -50,7 +155,7 @@ static void glfw_key_callback(GLFWwindow* window, int key, int scancode, int act
             static int last_window_xpos, last_window_ypos;
             static int last_window_width, last_window_height;
 
-            VK_CHECK(vkDeviceWaitIdle(vk.device));
+            // Swapchain is recreated by the main loop when the new window size is detected.
             GLFWmonitor* monitor = glfwGetWindowMonitor(window);
             if (monitor == nullptr) {
                 glfwGetWindowPos(window, &last_window_xpos, &last_window_ypos);
@@ -85,19 +190,31 @@ int main(int argc, char** argv) {
     GLFWwindow* glfw_window = glfwCreateWindow(window_width, window_height, "Vulkan demo", nullptr, nullptr);
     assert(glfw_window != nullptr);
     glfwSetKeyCallback(glfw_window, glfw_key_callback);
+    install_window_event_callbacks(glfw_window); // before ImGui installs its callbacks that chain to these
 
     Vk_Demo demo{};
-    demo.initialize(glfw_window, options.enable_validation_layers);
+    demo.initialize(glfw_window, options);
 
     bool prev_vsync = demo.vsync_enabled();
 
     bool window_active = true;
 
+    // The frame slot is waited for before input is polled, so the frame is recorded and
+    // submitted right after the input is sampled. In render-on-demand mode the loop blocks
+    // in wait_for_events while nothing changes.
     while (!glfwWindowShouldClose(glfw_window)) {
-        if (window_active)
-            demo.run_frame();
+        if (window_active && !demo.needs_frame()) {
+            demo.wait_for_events();
+        } else {
+            if (window_active)
+                demo.wait_for_next_frame();
+            glfwPollEvents();
+        }
 
-        glfwPollEvents();
+        if (window_events_received) {
+            window_events_received = false;
+            demo.request_redraw();
+        }
 
         int width, height;
         glfwGetWindowSize(glfw_window, &width, &height);
@@ -110,22 +227,28 @@ int main(int argc, char** argv) {
             window_width = width;
             window_height = height;
             recreate_swapchain = true;
+        } else if (vk.swapchain_recreate_requested) {
+            recreate_swapchain = true; // acquire or present reported that the swapchain is out of date
         }
 
         window_active = (width != 0 && height != 0);
 
-        if (!window_active)
-            continue; 
+        // Minimized window, nothing to render until the next event.
+        if (!window_active) {
+            glfwWaitEvents();
+            continue;
+        }
 
+        // The old resources are retired and destroyed when the frames in flight are finished.
         if (recreate_swapchain) {
-            VK_CHECK(vkDeviceWaitIdle(vk.device));
             demo.release_resolution_dependent_resources();
-            vk_release_resolution_dependent_resources();
-            vk_restore_resolution_dependent_resources(demo.vsync_enabled());
+            vk_recreate_resolution_dependent_resources(demo.vsync_enabled());
             demo.restore_resolution_dependent_resources();
+            demo.request_redraw();
             recreate_swapchain = false;
         }
-        platform::sleep(1);
+        if (demo.needs_frame())
+            demo.run_frame();
     }
 
     demo.shutdown();
@@ -187,6 +187,29 @@ Matrix4x4 perspective_transform_opengl_z01(float fovy_radians, float aspect_rati
     return proj;
 }
 
+void get_frustum_planes(const Matrix4x4& clip_transform, Vector4 planes[6]) {
+    auto row = [&clip_transform](int i) {
+        return Vector4(clip_transform.a[i][0], clip_transform.a[i][1], clip_transform.a[i][2], clip_transform.a[i][3]);
+    };
+    auto combine = [](Vector4 a, Vector4 b, float sign) {
+        return Vector4(a.x + sign*b.x, a.y + sign*b.y, a.z + sign*b.z, a.w + sign*b.w);
+    };
+    const Vector4 r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+
+    // Clip volume: -w <= x <= w, -w <= y <= w, 0 <= z <= w.
+    planes[0] = combine(r3, r0, 1.f);
+    planes[1] = combine(r3, r0, -1.f);
+    planes[2] = combine(r3, r1, 1.f);
+    planes[3] = combine(r3, r1, -1.f);
+    planes[4] = r2;
+    planes[5] = combine(r3, r2, -1.f);
+
+    for (int i = 0; i < 6; i++) {
+        float length = Vector3(planes[i]).length();
+        planes[i] = Vector4(planes[i].x / length, planes[i].y / length, planes[i].z / length, planes[i].w / length);
+    }
+}
+
 Vector3 transform_point(const Matrix3x4& m, Vector3 p) {
     Vector3 p2;
     p2.x = m.a[0][0]*p.x + m.a[0][1]*p.y + m.a[0][2]*p.z + m.a[0][3];
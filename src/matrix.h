@@ -39,5 +39,10 @@ Matrix3x4 look_at_transform(Vector3 from, Vector3 to, Vector3 up);
 // space points top-down with regard to eye space vertical direction (to match Vulkan viewport).
 Matrix4x4 perspective_transform_opengl_z01(float fovy_radians, float aspect_ratio, float near, float far);
 
+// Extracts frustum planes from clip transform (projection * view) produced with perspective_transform_opengl_z01.
+// Planes are stored in order left, right, bottom, top, near, far. Each plane (a, b, c, d) is normalized
+// and the points inside the frustum satisfy a*x + b*y + c*z + d >= 0.
+void get_frustum_planes(const Matrix4x4& clip_transform, Vector4 planes[6]);
+
 Vector3 transform_point(const Matrix3x4& m, Vector3 p);
 Vector3 transform_vector(const Matrix3x4& m, Vector3 v);
@@ -0,0 +1,245 @@
+#include "common.h"
+#include "cpu_profiler.h"
+#include "pipeline_compiler.h"
+#include "shader_manager.h"
+
+#include <algorithm>
+#include <cassert>
+
+void Async_Pipeline::destroy() {
+    vkDestroyPipeline(vk.device, handle.load(std::memory_order_acquire), nullptr);
+    handle.store(VK_NULL_HANDLE, std::memory_order_relaxed);
+}
+
+void Reloaded_Pipeline::destroy() {
+    vkDestroyPipeline(vk.device, take(), nullptr);
+}
+
+namespace {
+// Shader modules are owned by the job and released also when pipeline creation throws.
+struct Shader_Module_Guard {
+    VkShaderModule module;
+    ~Shader_Module_Guard() {
+        vkDestroyShaderModule(vk.device, module, nullptr);
+    }
+};
+}
+
+// Called by the worker thread. The pipeline that was not taken yet was never used for rendering
+// and can be destroyed immediately. The check and the update are done under the lock, otherwise
+// a worker with an older generation could pass the check and then overwrite the newer pipeline.
+static void store_reloaded_pipeline(Reloaded_Pipeline* pipeline, VkPipeline handle, uint32_t generation) {
+    std::lock_guard<std::mutex> lock(pipeline->store_mutex);
+    if (pipeline->generation.load(std::memory_order_acquire) != generation) {
+        vkDestroyPipeline(vk.device, handle, nullptr); // superseded by the newer reload request
+        return;
+    }
+    VkPipeline unused_pipeline = pipeline->handle.exchange(handle, std::memory_order_acq_rel);
+    vkDestroyPipeline(vk.device, unused_pipeline, nullptr);
+}
+
+void Pipeline_Compiler::initialize(uint32_t worker_count) {
+    assert(worker_count > 0);
+    quit = false;
+    for (uint32_t i = 0; i < worker_count; i++)
+        workers.emplace_back(&Pipeline_Compiler::worker_thread, this);
+}
+
+void Pipeline_Compiler::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    job_available.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+    workers.clear();
+
+    // Queued jobs are dropped, the layouts and render passes they reference can be destroyed
+    // right after shutdown. Cancelled jobs only release the shader modules they own.
+    for (Queued_Job& job : jobs)
+        job.run(true);
+    jobs.clear();
+}
+
+void Pipeline_Compiler::compile_graphics_pipeline(Async_Pipeline* pipeline, const char* name,
+    const Vk_Graphics_Pipeline_State& state, VkPipelineLayout pipeline_layout, VkRenderPass render_pass,
+    VkShaderModule vertex_shader, VkShaderModule fragment_shader)
+{
+    assert(!pipeline->is_ready());
+    schedule(name, [this, pipeline, name = std::string(name), state, pipeline_layout, render_pass, vertex_shader, fragment_shader](bool cancelled) {
+        Shader_Module_Guard vertex_shader_guard{vertex_shader};
+        Shader_Module_Guard fragment_shader_guard{fragment_shader};
+        if (cancelled)
+            return;
+
+        Timestamp t;
+        VkPipeline handle = vk_create_graphics_pipeline(state, pipeline_layout, render_pass, vertex_shader, fragment_shader);
+        float compile_time_ms = elapsed_microseconds(t) / 1000.f;
+
+        vk_set_debug_name(handle, name.c_str());
+        add_compile_stats(name, compile_time_ms);
+        pipeline->handle.store(handle, std::memory_order_release);
+    });
+}
+
+void Pipeline_Compiler::compile_compute_pipeline(Async_Pipeline* pipeline, const char* name,
+    VkPipelineLayout pipeline_layout, VkShaderModule compute_shader,
+    const Specialization_Constants& specialization_constants)
+{
+    assert(!pipeline->is_ready());
+    schedule(name, [this, pipeline, name = std::string(name), pipeline_layout, compute_shader,
+        specialization_constants = Specialization_Constants(specialization_constants)](bool cancelled) mutable {
+        Shader_Module_Guard compute_shader_guard{compute_shader};
+        if (cancelled)
+            return;
+
+        Timestamp t;
+        VkPipeline handle = vk_create_compute_pipeline(pipeline_layout, compute_shader, specialization_constants.get_info(), name.c_str());
+        float compile_time_ms = elapsed_microseconds(t) / 1000.f;
+
+        add_compile_stats(name, compile_time_ms);
+        pipeline->handle.store(handle, std::memory_order_release);
+    });
+}
+
+void Pipeline_Compiler::reload_graphics_pipeline(Reloaded_Pipeline* pipeline, const char* name,
+    const Vk_Graphics_Pipeline_State& state, VkPipelineLayout pipeline_layout, VkRenderPass render_pass,
+    const char* vertex_shader_file, const char* fragment_shader_file)
+{
+    uint32_t generation = pipeline->generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+    schedule(std::string(name) + " (reload)", [this, pipeline, generation, name = std::string(name), state, pipeline_layout, render_pass,
+        vertex_shader_file = std::string(vertex_shader_file), fragment_shader_file = std::string(fragment_shader_file ? fragment_shader_file : "")](bool cancelled)
+    {
+        if (cancelled)
+            return;
+
+        Timestamp t;
+        Shader_Module_Guard vertex_shader{VK_NULL_HANDLE};
+        Shader_Module_Guard fragment_shader{VK_NULL_HANDLE};
+        try {
+            vertex_shader.module = load_shader(vertex_shader_file);
+            if (!fragment_shader_file.empty())
+                fragment_shader.module = load_shader(fragment_shader_file);
+        } catch (const std::runtime_error&) {
+            printf("%s: shader reload failed, the current pipeline is kept\n", name.c_str());
+            return;
+        }
+
+        VkPipeline handle = vk_create_graphics_pipeline(state, pipeline_layout, render_pass, vertex_shader.module, fragment_shader.module);
+        float compile_time_ms = elapsed_microseconds(t) / 1000.f;
+
+        vk_set_debug_name(handle, name.c_str());
+        add_compile_stats(name + " (reload)", compile_time_ms);
+        store_reloaded_pipeline(pipeline, handle, generation);
+    });
+}
+
+void Pipeline_Compiler::reload_compute_pipeline(Reloaded_Pipeline* pipeline, const char* name,
+    VkPipelineLayout pipeline_layout, const char* compute_shader_file,
+    const Specialization_Constants& specialization_constants)
+{
+    uint32_t generation = pipeline->generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+    schedule(std::string(name) + " (reload)", [this, pipeline, generation, name = std::string(name), pipeline_layout,
+        compute_shader_file = std::string(compute_shader_file), specialization_constants = Specialization_Constants(specialization_constants)](bool cancelled) mutable
+    {
+        if (cancelled)
+            return;
+
+        Timestamp t;
+        Shader_Module_Guard compute_shader{VK_NULL_HANDLE};
+        try {
+            compute_shader.module = load_shader(compute_shader_file);
+        } catch (const std::runtime_error&) {
+            printf("%s: shader reload failed, the current pipeline is kept\n", name.c_str());
+            return;
+        }
+
+        VkPipeline handle = vk_create_compute_pipeline(pipeline_layout, compute_shader.module, specialization_constants.get_info(), name.c_str());
+        float compile_time_ms = elapsed_microseconds(t) / 1000.f;
+
+        add_compile_stats(name + " (reload)", compile_time_ms);
+        store_reloaded_pipeline(pipeline, handle, generation);
+    });
+}
+
+void Pipeline_Compiler::wait_idle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    all_jobs_done.wait(lock, [this]() { return jobs.empty() && active_job_count == 0; });
+}
+
+bool Pipeline_Compiler::has_pending_jobs() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !jobs.empty() || active_job_count > 0;
+}
+
+uint32_t Pipeline_Compiler::get_failed_job_count() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return (uint32_t)std::count_if(compile_stats.begin(), compile_stats.end(), [](const Pipeline_Compile_Stats& stats) {
+        return stats.failed;
+    });
+}
+
+std::vector<Pipeline_Compile_Stats> Pipeline_Compiler::get_compile_stats() {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return compile_stats;
+}
+
+void Pipeline_Compiler::add_compile_stats(const std::string& name, float compile_time_ms) {
+    set_compile_stats(Pipeline_Compile_Stats{name, compile_time_ms, false});
+}
+
+void Pipeline_Compiler::add_failure(const std::string& name) {
+    set_compile_stats(Pipeline_Compile_Stats{name, 0.f, true});
+}
+
+// Each reload adds a compilation of the same pipeline, only the latest one is kept.
+void Pipeline_Compiler::set_compile_stats(const Pipeline_Compile_Stats& stats) {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    auto it = std::find_if(compile_stats.begin(), compile_stats.end(), [&stats](const Pipeline_Compile_Stats& entry) {
+        return entry.name == stats.name;
+    });
+    if (it != compile_stats.end())
+        *it = stats;
+    else
+        compile_stats.push_back(stats);
+}
+
+void Pipeline_Compiler::schedule(const std::string& name, Job job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(Queued_Job{name, std::move(job)});
+    }
+    job_available.notify_one();
+}
+
+void Pipeline_Compiler::worker_thread() {
+    cpu_profiler.set_thread_name("pipeline compiler");
+    while (true) {
+        Queued_Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_available.wait(lock, [this]() { return quit || !jobs.empty(); });
+            if (quit)
+                return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            active_job_count++;
+        }
+
+        // Vulkan errors are reported with exceptions. The pipeline is not published, so the fallback
+        // pipeline stays in use, and the failure is reported in the compile stats.
+        try {
+            CPU_TIME_SCOPE("pipeline_compiler_job");
+            job.run(false);
+        } catch (const std::exception&) {
+            add_failure(job.name);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            active_job_count--;
+        }
+        all_jobs_done.notify_all();
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "utils.h"
+#include "vk.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pipeline compiled by Pipeline_Compiler on a worker thread.
+struct Async_Pipeline {
+    std::atomic<VkPipeline>     handle      = VK_NULL_HANDLE; // set by the worker thread when compilation is finished
+    VkPipeline                  fallback    = VK_NULL_HANDLE; // optional, used until the pipeline is ready
+
+    bool is_ready() const {
+        return handle.load(std::memory_order_acquire) != VK_NULL_HANDLE;
+    }
+
+    // Returns compiled pipeline or fallback pipeline if compilation is not finished yet.
+    // VK_NULL_HANDLE means the draw should be skipped.
+    VkPipeline get() const {
+        VkPipeline pipeline = handle.load(std::memory_order_acquire);
+        return pipeline != VK_NULL_HANDLE ? pipeline : fallback;
+    }
+
+    // Destroys compiled pipeline. Fallback pipeline is not owned by Async_Pipeline.
+    void destroy();
+};
+
+// Pipeline rebuilt by Pipeline_Compiler after the shader source has changed. The render thread
+// takes the new pipeline at the frame boundary and retires the old one with deferred destruction.
+struct Reloaded_Pipeline {
+    std::atomic<VkPipeline>     handle      = VK_NULL_HANDLE;
+    std::atomic<uint32_t>       generation  = 0; // incremented for each requested reload
+    std::mutex                  store_mutex; // makes generation check and handle update atomic for the workers
+
+    // Returns rebuilt pipeline or VK_NULL_HANDLE. The caller owns the returned pipeline.
+    VkPipeline take() {
+        return handle.exchange(VK_NULL_HANDLE, std::memory_order_acq_rel);
+    }
+
+    // Destroys the pipeline that was not taken.
+    void destroy();
+};
+
+struct Pipeline_Compile_Stats {
+    std::string name;
+    float       compile_time_ms;
+    bool        failed; // pipeline creation threw, the current or fallback pipeline is kept
+};
+
+// Compiles pipelines on the pool of worker threads. All workers share vk.pipeline_cache.
+class Pipeline_Compiler {
+public:
+    void initialize(uint32_t worker_count);
+    // Waits for the running jobs and drops the queued ones. Should be called before the objects
+    // referenced by the scheduled pipelines are destroyed.
+    void shutdown();
+
+    // Schedules compilation of the pipeline. Shader modules are owned by the compiler after this
+    // call and get destroyed when compilation is finished. Async_Pipeline object must stay alive
+    // until the pipeline is ready.
+    void compile_graphics_pipeline(Async_Pipeline* pipeline, const char* name,
+        const Vk_Graphics_Pipeline_State& state, VkPipelineLayout pipeline_layout, VkRenderPass render_pass,
+        VkShaderModule vertex_shader, VkShaderModule fragment_shader);
+
+    void compile_compute_pipeline(Async_Pipeline* pipeline, const char* name,
+        VkPipelineLayout pipeline_layout, VkShaderModule compute_shader,
+        const Specialization_Constants& specialization_constants);
+
+    // Schedules compilation of the shaders and the pipeline. The result is stored in Reloaded_Pipeline.
+    // fragment_shader_file is null for depth-only pipelines.
+    // Only the most recent reload request is kept if several are in flight. If the shader fails
+    // to compile the error is reported and Reloaded_Pipeline is not updated.
+    void reload_graphics_pipeline(Reloaded_Pipeline* pipeline, const char* name,
+        const Vk_Graphics_Pipeline_State& state, VkPipelineLayout pipeline_layout, VkRenderPass render_pass,
+        const char* vertex_shader_file, const char* fragment_shader_file);
+
+    void reload_compute_pipeline(Reloaded_Pipeline* pipeline, const char* name,
+        VkPipelineLayout pipeline_layout, const char* compute_shader_file,
+        const Specialization_Constants& specialization_constants);
+
+    // Blocks until all scheduled pipelines are compiled.
+    void wait_idle();
+
+    // Returns true if some scheduled pipelines are not compiled yet.
+    bool has_pending_jobs();
+
+    // Compile time of the most recent compilation of each pipeline, including the failed ones.
+    std::vector<Pipeline_Compile_Stats> get_compile_stats();
+
+    // Number of pipelines whose most recent compilation failed.
+    uint32_t get_failed_job_count();
+
+private:
+    // The job is called with cancelled == true if the compiler is shut down before the job starts.
+    using Job = std::function<void(bool cancelled)>;
+
+    struct Queued_Job {
+        std::string name; // reported if the job fails
+        Job         run;
+    };
+
+    void schedule(const std::string& name, Job job);
+    void add_compile_stats(const std::string& name, float compile_time_ms);
+    void add_failure(const std::string& name);
+    void set_compile_stats(const Pipeline_Compile_Stats& stats); // replaces the previous entry with the same name
+    void worker_thread();
+
+private:
+    std::vector<std::thread>            workers;
+    std::deque<Queued_Job>              jobs;
+    uint32_t                            active_job_count = 0;
+    bool                                quit = false;
+    std::mutex                          mutex;
+    std::condition_variable             job_available;
+    std::condition_variable             all_jobs_done;
+
+    std::mutex                          stats_mutex;
+    std::vector<Pipeline_Compile_Stats> compile_stats; // one entry per pipeline name
+};
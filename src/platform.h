@@ -8,4 +8,6 @@ namespace platform
 {
 VkSurfaceKHR create_surface(VkInstance instance, GLFWwindow* window);
 void sleep(int milliseconds);
+// User and kernel CPU time of all threads of the process.
+double get_process_cpu_time_seconds();
 }
@@ -0,0 +1,277 @@
+#include "common.h"
+#include "shader_manager.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+
+// Part of the cache key. Change it when compiler options change to invalidate cached binaries.
+static const char* compiler_options_key = "vulkan1.1 spv1.3 opt strip-debug";
+
+static bool runtime_compilation;
+static std::string shader_dir;
+
+enum class Shader_Stage {
+    vertex,
+    fragment,
+    compute
+};
+
+static Shader_Stage get_shader_stage(const std::string& shader_file) {
+    auto ends_with = [&shader_file](const char* suffix) {
+        size_t n = strlen(suffix);
+        return shader_file.size() >= n && shader_file.compare(shader_file.size() - n, n, suffix) == 0;
+    };
+    if (ends_with(".vert.glsl"))
+        return Shader_Stage::vertex;
+    if (ends_with(".frag.glsl"))
+        return Shader_Stage::fragment;
+    if (ends_with(".comp.glsl"))
+        return Shader_Stage::compute;
+    error("unknown shader stage: " + shader_file);
+    return Shader_Stage::vertex;
+}
+
+static uint64_t hash_fnv1a_64(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static std::string read_shader_source(const std::string& shader_file) {
+    std::string path = (std::filesystem::path(shader_dir) / shader_file).string();
+    std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+    if (!file)
+        error("failed to open shader file: " + path);
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+}
+
+// Replaces #include "file" directives with the contents of the included files. Each file is
+// included only once. #line directives keep compiler messages pointing to the original files.
+static void expand_includes(const std::string& file_name, std::unordered_set<std::string>& included_files, std::string& result) {
+    std::istringstream source(read_shader_source(file_name));
+    std::string line;
+    int line_number = 0;
+    while (std::getline(source, line)) {
+        line_number++;
+
+        size_t pos = line.find_first_not_of(" \t");
+        if (pos == std::string::npos || line.compare(pos, 8, "#include") != 0) {
+            result += line;
+            result += '\n';
+            continue;
+        }
+
+        size_t name_begin = line.find('"', pos);
+        size_t name_end = (name_begin == std::string::npos) ? std::string::npos : line.find('"', name_begin + 1);
+        if (name_end == std::string::npos)
+            error(file_name + "(" + std::to_string(line_number) + "): invalid #include directive");
+
+        std::string include_file = line.substr(name_begin + 1, name_end - name_begin - 1);
+        if (included_files.insert(include_file).second) {
+            result += "#line 1 \"" + include_file + "\"\n";
+            expand_includes(include_file, included_files, result);
+        }
+        result += "#line " + std::to_string(line_number + 1) + " \"" + file_name + "\"\n";
+    }
+}
+
+// Defines are inserted right after the #version directive.
+static std::string preprocess_shader(const std::string& shader_file, const std::vector<std::string>& defines) {
+    std::string source;
+    std::unordered_set<std::string> included_files;
+    expand_includes(shader_file, included_files, source);
+
+    if (defines.empty())
+        return source;
+
+    size_t version_pos = source.find("#version");
+    if (version_pos == std::string::npos)
+        error(shader_file + ": #version directive is missing");
+
+    size_t insert_pos = source.find('\n', version_pos);
+    insert_pos = (insert_pos == std::string::npos) ? source.size() : insert_pos + 1;
+    int version_line = 1 + int(std::count(source.begin(), source.begin() + version_pos, '\n'));
+
+    std::string define_lines;
+    for (const std::string& define : defines) {
+        std::string d = define;
+        size_t equal_pos = d.find('=');
+        if (equal_pos != std::string::npos)
+            d[equal_pos] = ' ';
+        define_lines += "#define " + d + "\n";
+    }
+    define_lines += "#line " + std::to_string(version_line + 1) + "\n";
+    source.insert(insert_pos, define_lines);
+    return source;
+}
+
+static std::string get_cache_file_path(uint64_t hash) {
+    char file_name[32];
+    snprintf(file_name, sizeof(file_name), "%016llx.spv", (unsigned long long)hash);
+    return get_resource_path(std::string("spirv_cache/") + file_name);
+}
+
+static bool load_cached_spirv(const std::string& path, std::vector<uint32_t>& spirv) {
+    std::ifstream file(path, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+    if (!file)
+        return false;
+
+    std::streamoff size = file.tellg();
+    if (size <= 0 || size % 4 != 0)
+        return false;
+
+    spirv.resize(size_t(size / 4));
+    file.seekg(0, std::ios_base::beg);
+    return bool(file.read(reinterpret_cast<char*>(spirv.data()), size));
+}
+
+// The binary is written into a temporary file and then renamed, so concurrent processes
+// never see a partially written cache entry.
+static void store_cached_spirv(const std::string& path, const std::vector<uint32_t>& spirv) {
+    static std::atomic<uint32_t> temp_file_counter;
+
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+    std::ostringstream temp_path;
+    temp_path << path << ".tmp" << std::this_thread::get_id() << "_" << temp_file_counter++;
+    {
+        std::ofstream file(temp_path.str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        if (!file || !file.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t))) {
+            printf("failed to write shader cache file: %s\n", path.c_str());
+            return;
+        }
+    }
+    std::filesystem::rename(temp_path.str(), path, ec);
+    if (ec) {
+        std::filesystem::remove(temp_path.str(), ec);
+        printf("failed to write shader cache file: %s\n", path.c_str());
+    }
+}
+
+// Runtime compilation runs the same tools as the offline build step: glslangValidator and spirv-opt
+// from the Vulkan SDK. When VULKAN_SDK is not set the tools are searched in PATH.
+static std::string get_sdk_tool(const char* tool_name) {
+    const char* sdk_dir = getenv("VULKAN_SDK");
+    if (sdk_dir == nullptr)
+        return tool_name;
+#ifdef _WIN32
+    const char* bin_dir = "Bin";
+#else
+    const char* bin_dir = "bin";
+#endif
+    return "\"" + (std::filesystem::path(sdk_dir) / bin_dir / tool_name).string() + "\"";
+}
+
+static std::string read_text_file(const std::string& path) {
+    std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+}
+
+static std::vector<uint32_t> compile_glsl(const std::string& shader_file, Shader_Stage stage, const std::string& source) {
+    static std::atomic<uint32_t> temp_file_counter;
+
+    std::error_code ec;
+    std::filesystem::create_directories(get_resource_path("spirv_cache"), ec);
+
+    std::ostringstream temp_path;
+    temp_path << get_resource_path("spirv_cache/compile") << std::this_thread::get_id() << "_" << temp_file_counter++;
+    const std::string source_path   = temp_path.str() + ".glsl";
+    const std::string spirv_path    = temp_path.str() + ".spv";
+    const std::string log_path      = temp_path.str() + ".log";
+    {
+        std::ofstream file(source_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        if (!file || !file.write(source.data(), source.size()))
+            error("failed to write temporary shader file: " + source_path);
+    }
+
+    const char* stage_name = "vert";
+    if (stage == Shader_Stage::fragment)
+        stage_name = "frag";
+    else if (stage == Shader_Stage::compute)
+        stage_name = "comp";
+
+    // Matches the custom build step of the project.
+    std::string command =
+        get_sdk_tool("glslangValidator") + " -V --target-env vulkan1.1 -S " + stage_name + " \"" + source_path + "\" -o \"" + spirv_path + "\"" +
+        " > \"" + log_path + "\" 2>&1 && " +
+        get_sdk_tool("spirv-opt") + " \"" + spirv_path + "\" -O --strip-debug -o \"" + spirv_path + "\"" +
+        " >> \"" + log_path + "\" 2>&1";
+#ifdef _WIN32
+    command = "\"" + command + "\""; // cmd /c strips the outer quotes when the command starts with a quote
+#endif
+
+    std::vector<uint32_t> spirv;
+    const bool compiled = std::system(command.c_str()) == 0 && load_cached_spirv(spirv_path, spirv);
+    const std::string log = compiled ? std::string() : read_text_file(log_path);
+
+    std::filesystem::remove(source_path, ec);
+    std::filesystem::remove(spirv_path, ec);
+    std::filesystem::remove(log_path, ec);
+
+    // glslangValidator reports errors against the temporary file, #line directives give the original file and line.
+    if (!compiled)
+        error("failed to compile shader " + shader_file + ":\n" + log);
+    return spirv;
+}
+
+void initialize_shader_manager(bool runtime_compilation_, const std::string& shader_dir_) {
+    runtime_compilation = runtime_compilation_;
+    shader_dir = shader_dir_;
+}
+
+std::vector<uint32_t> get_shader_spirv(const std::string& shader_file, const std::vector<std::string>& defines) {
+    Shader_Stage stage = get_shader_stage(shader_file);
+    std::string source = preprocess_shader(shader_file, defines);
+
+    uint64_t hash = hash_fnv1a_64(compiler_options_key, strlen(compiler_options_key));
+    hash = hash_fnv1a_64(&stage, sizeof(stage), hash);
+    hash = hash_fnv1a_64(source.data(), source.size(), hash);
+
+    std::string cache_file = get_cache_file_path(hash);
+    std::vector<uint32_t> spirv;
+    if (load_cached_spirv(cache_file, spirv))
+        return spirv;
+
+    spirv = compile_glsl(shader_file, stage, source);
+    store_cached_spirv(cache_file, spirv);
+    return spirv;
+}
+
+std::vector<std::string> get_shader_dependencies(const std::string& shader_file) {
+    std::string source;
+    std::unordered_set<std::string> included_files;
+    expand_includes(shader_file, included_files, source);
+
+    std::vector<std::string> dependencies{shader_file};
+    dependencies.insert(dependencies.end(), included_files.begin(), included_files.end());
+    return dependencies;
+}
+
+VkShaderModule load_shader(const std::string& shader_file, const std::vector<std::string>& defines) {
+    if (!runtime_compilation) {
+        if (!defines.empty())
+            error(shader_file + ": defines require runtime shader compilation");
+
+        // mesh.frag.glsl -> spirv/mesh.frag.spv
+        std::string spirv_file = shader_file.substr(0, shader_file.rfind(".glsl")) + ".spv";
+        return vk_load_spirv("spirv/" + spirv_file);
+    }
+
+    std::vector<uint32_t> spirv = get_shader_spirv(shader_file, defines);
+    return vk_create_shader_module(spirv.data(), spirv.size() * sizeof(uint32_t));
+}
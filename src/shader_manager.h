@@ -0,0 +1,22 @@
+#pragma once
+
+#include "vk.h"
+
+#include <string>
+#include <vector>
+
+// When runtime compilation is enabled, shaders are compiled from GLSL sources in shader_dir
+// and the resulting SPIR-V is cached in data/spirv_cache. Otherwise precompiled SPIR-V from
+// data/spirv is used. Runtime compilation runs glslangValidator and spirv-opt from the Vulkan SDK.
+void initialize_shader_manager(bool runtime_compilation, const std::string& shader_dir);
+
+// Shader is specified by its source file name, e.g. "mesh.frag.glsl". Shader stage is
+// defined by the file name suffix. Each define has format NAME or NAME=VALUE.
+VkShaderModule load_shader(const std::string& shader_file, const std::vector<std::string>& defines = {});
+
+// Returns SPIR-V of the shader from the cache or compiles it. Throws std::runtime_error
+// if the shader can't be compiled. Can be called from any thread.
+std::vector<uint32_t> get_shader_spirv(const std::string& shader_file, const std::vector<std::string>& defines = {});
+
+// Returns the shader file and all files it includes.
+std::vector<std::string> get_shader_dependencies(const std::string& shader_file);
@@ -5,6 +5,19 @@ struct Frag_In {
     vec2 uv;
 };
 
+// Matrix3x4 rows, the last row is (0, 0, 0, 1).
+struct Instance_Transform {
+    vec4 rows[3];
+};
+
+vec3 transform_point(Instance_Transform t, vec4 p) {
+    return vec3(dot(t.rows[0], p), dot(t.rows[1], p), dot(t.rows[2], p));
+}
+
+vec3 transform_vector(Instance_Transform t, vec3 v) {
+    return vec3(dot(t.rows[0].xyz, v), dot(t.rows[1].xyz, v), dot(t.rows[2].xyz, v));
+}
+
 float srgb_encode(float c) {
     if (c <= 0.0031308f)
         return 12.92f * c;
@@ -3,23 +3,136 @@
 
 #include "common.glsl"
 
-layout(local_size_x = 32, local_size_y = 32) in;
+// Workgroup size is selected at pipeline creation time.
+layout(local_size_x_id = 0, local_size_y_id = 1) in;
+
+const uint Upscale_Filter_Bilinear = 0;
+const uint Upscale_Filter_Edge_Adaptive = 1;
 
 layout(push_constant) uniform Push_Constants {
     uvec2 viewport_size;
+    vec2 src_scale; // size of the rendered area relative to the output image size
+    uint upscale_filter;
+    float sharpness; // 0 disables sharpening
 };
 
-layout(binding=0) uniform sampler point_sampler;
+layout(binding=0) uniform sampler linear_sampler;
 layout(binding=1) uniform texture2D  output_image;
 layout(binding=2, rgba8) uniform writeonly image2D swapchain_image;
 
+ivec2 max_texel;
+
+vec3 fetch(ivec2 p) {
+    return texelFetch(sampler2D(output_image, linear_sampler), clamp(p, ivec2(0), max_texel), 0).rgb;
+}
+
+float luma(vec3 c) {
+    return dot(c, vec3(0.299, 0.587, 0.114));
+}
+
+// Polynomial approximation of Lanczos2 window, x2 is squared distance.
+float lanczos2_approx(float x2) {
+    x2 = min(x2, 4.0);
+    float a = 0.4 * x2 - 1.0;
+    float b = 0.25 * x2 - 1.0;
+    return (25.0/16.0 * a * a - 9.0/16.0) * b * b;
+}
+
+// Edge-adaptive resampling in the spirit of FSR1 EASU. The 4x4 neighborhood is filtered with
+// Lanczos2 kernel that is stretched along the local edge direction, so edges stay sharp and
+// are not stair-stepped. The result is clamped to the nearest 2x2 texels to remove ringing.
+vec3 sample_edge_adaptive(vec2 p) {
+    ivec2 base = ivec2(floor(p - 0.5));
+    vec2 f = p - 0.5 - vec2(base);
+
+    vec3 c[4][4];
+    float l[4][4];
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            c[y][x] = fetch(base + ivec2(x - 1, y - 1));
+            l[y][x] = luma(c[y][x]);
+        }
+    }
+
+    // Luma gradient at the sample position: central differences of the 2x2 quad, bilinearly weighted.
+    vec2 gradient = vec2(0);
+    float min_l = 1e30, max_l = -1e30;
+    for (int y = 1; y <= 2; y++) {
+        for (int x = 1; x <= 2; x++) {
+            float w = (x == 1 ? 1.0 - f.x : f.x) * (y == 1 ? 1.0 - f.y : f.y);
+            gradient += w * vec2(l[y][x+1] - l[y][x-1], l[y+1][x] - l[y-1][x]);
+            min_l = min(min_l, l[y][x]);
+            max_l = max(max_l, l[y][x]);
+        }
+    }
+    float gradient_length = length(gradient);
+    vec2 dir = gradient_length > 1e-5 ? gradient / gradient_length : vec2(1, 0);
+
+    // 1 on a clean edge, close to 0 on flat areas and noise where differences cancel out.
+    float edge = clamp(gradient_length / (max_l - min_l + 1e-4), 0.0, 1.0);
+    float along_edge_scale = 1.0 - 0.5 * edge;
+
+    vec3 sum = vec3(0);
+    float weight_sum = 0.0;
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            if ((x == 0 || x == 3) && (y == 0 || y == 3))
+                continue; // corners are outside of the kernel support
+            vec2 d = vec2(x - 1, y - 1) - f;
+            vec2 v = vec2(dot(d, dir), dot(d, vec2(-dir.y, dir.x)) * along_edge_scale);
+            float w = lanczos2_approx(dot(v, v));
+            sum += w * c[y][x];
+            weight_sum += w;
+        }
+    }
+    vec3 color = sum / max(weight_sum, 1e-5);
+
+    vec3 min_c = min(min(c[1][1], c[1][2]), min(c[2][1], c[2][2]));
+    vec3 max_c = max(max(c[1][1], c[1][2]), max(c[2][1], c[2][2]));
+    return clamp(color, min_c, max_c);
+}
+
+// Contrast adaptive sharpening in the spirit of FidelityFX CAS. The sharpening weight is reduced
+// in high contrast areas to not produce halos. The cross of the nearest source texels is used as
+// neighborhood, so the filter works in the same pass as upscaling.
+vec3 sharpen(vec3 color, vec2 p) {
+    ivec2 center = ivec2(floor(p));
+    vec3 n = fetch(center + ivec2(0, -1));
+    vec3 s = fetch(center + ivec2(0, 1));
+    vec3 w = fetch(center + ivec2(-1, 0));
+    vec3 e = fetch(center + ivec2(1, 0));
+
+    vec3 min_c = clamp(min(color, min(min(n, s), min(w, e))), 0.0, 1.0);
+    vec3 max_c = clamp(max(color, max(max(n, s), max(w, e))), 0.0, 1.0);
+    vec3 amount = sqrt(clamp(min(min_c, 1.0 - max_c) / max(max_c, 1e-5), 0.0, 1.0));
+    vec3 lobe = -amount / mix(8.0, 5.0, sharpness);
+
+    return clamp((color + lobe * (n + s + w + e)) / (1.0 + 4.0 * lobe), 0.0, 1.0);
+}
+
 void main() {
     ivec2 loc = ivec2(gl_GlobalInvocationID.xy);
 
     if (loc.x < viewport_size.x && loc.y < viewport_size.y) {
-        float s = (gl_GlobalInvocationID.x + 0.5) / viewport_size.x;
-        float t = (gl_GlobalInvocationID.y + 0.5) / viewport_size.y;
-        vec4 color = textureLod(sampler2D(output_image, point_sampler), vec2(s, t), 0);
-        imageStore(swapchain_image, loc, color);
+        vec2 texture_size = vec2(textureSize(sampler2D(output_image, linear_sampler), 0));
+        max_texel = ivec2(src_scale * texture_size + 0.5) - 1;
+
+        vec2 uv = (vec2(gl_GlobalInvocationID.xy) + 0.5) / vec2(viewport_size) * src_scale;
+        vec2 p = uv * texture_size; // position in texels
+
+        vec3 color;
+        if (upscale_filter == Upscale_Filter_Edge_Adaptive && src_scale.x < 1.0) {
+            color = sample_edge_adaptive(p);
+        } else {
+            // Bilinear filter should not fetch texels outside of the rendered area.
+            vec2 half_texel = 0.5 / texture_size;
+            uv = clamp(uv, half_texel, src_scale - half_texel);
+            color = textureLod(sampler2D(output_image, linear_sampler), uv, 0).rgb;
+        }
+
+        if (sharpness > 0.0)
+            color = sharpen(color, p);
+
+        imageStore(swapchain_image, loc, vec4(color, 1.0));
     }
 }
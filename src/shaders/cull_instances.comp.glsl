@@ -0,0 +1,140 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "common.glsl"
+
+layout(local_size_x = 64) in;
+
+// Cull_Phase
+const uint phase_frustum                = 0;
+const uint phase_occlusion_first_pass   = 1;
+const uint phase_occlusion_second_pass  = 2;
+
+layout(push_constant) uniform Push_Constants {
+    uint phase;
+};
+
+layout(std140, binding=0) uniform Cull_Uniforms {
+    mat4x4 view_proj;
+    vec4 frustum_planes[6];
+    vec4 bounding_sphere; // xyz - center with model transform applied, w - radius
+    uint instance_count;
+    uint index_count;
+    uvec2 hi_z_size;
+    uint hi_z_level_count;
+};
+
+// VkDrawIndexedIndirectCommand
+struct Draw_Command {
+    uint    index_count;
+    uint    instance_count;
+    uint    first_index;
+    int     vertex_offset;
+    uint    first_instance;
+};
+
+layout(std430, binding=1) readonly buffer Instance_Buffer {
+    Instance_Transform instance_transforms[];
+};
+
+// The first instance_count commands are drawn in the first pass, the rest in the second pass.
+layout(std430, binding=2) writeonly buffer Draw_Command_Buffer {
+    Draw_Command draw_commands[];
+};
+
+// Cull_Stats
+layout(std430, binding=3) buffer Draw_Count_Buffer {
+    uint first_pass_draw_count;
+    uint second_pass_draw_count;
+    uint frustum_visible_count;
+    uint occluded_count;
+};
+
+layout(std430, binding=4) buffer Visibility_Buffer {
+    uint visibility[];
+};
+
+layout(set=1, binding=0) uniform sampler point_sampler;
+layout(set=1, binding=1) uniform texture2D hi_z;
+
+// Projects the bounding box of the sphere and compares its nearest depth with Hi-Z texels
+// that cover the projected rectangle. The level is selected so the rectangle covers at most 2x2 texels.
+bool is_occluded(vec3 center, float radius) {
+    vec2 uv_min = vec2(1.0);
+    vec2 uv_max = vec2(0.0);
+    float min_depth = 1.0;
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = view_proj * vec4(corner, 1.0);
+        if (clip.w <= 0.0)
+            return false; // crosses the camera plane
+        vec3 ndc = clip.xyz / clip.w;
+        vec2 uv = ndc.xy * 0.5 + 0.5;
+        uv_min = min(uv_min, uv);
+        uv_max = max(uv_max, uv);
+        min_depth = min(min_depth, ndc.z);
+    }
+    uv_min = clamp(uv_min, 0.0, 1.0);
+    uv_max = clamp(uv_max, 0.0, 1.0);
+
+    vec2 rect_size = (uv_max - uv_min) * vec2(hi_z_size);
+    uint level = uint(clamp(ceil(log2(max(max(rect_size.x, rect_size.y), 1.0))), 0.0, float(hi_z_level_count - 1)));
+
+    ivec2 level_size = max(ivec2(hi_z_size) >> level, ivec2(1));
+    ivec2 p0 = min(ivec2(uv_min * vec2(level_size)), level_size - 1);
+    ivec2 p1 = min(ivec2(uv_max * vec2(level_size)), level_size - 1);
+
+    float max_depth = 0.0;
+    for (int y = p0.y; y <= p1.y; y++) {
+        for (int x = p0.x; x <= p1.x; x++)
+            max_depth = max(max_depth, texelFetch(sampler2D(hi_z, point_sampler), ivec2(x, y), int(level)).r);
+    }
+    return min_depth > max_depth;
+}
+
+void main() {
+    uint instance_index = gl_GlobalInvocationID.x;
+    if (instance_index >= instance_count)
+        return;
+
+    Instance_Transform t = instance_transforms[instance_index];
+    vec3 center = transform_point(t, vec4(bounding_sphere.xyz, 1.0));
+
+    vec3 axis_x = vec3(t.rows[0].x, t.rows[1].x, t.rows[2].x);
+    vec3 axis_y = vec3(t.rows[0].y, t.rows[1].y, t.rows[2].y);
+    vec3 axis_z = vec3(t.rows[0].z, t.rows[1].z, t.rows[2].z);
+    float radius = bounding_sphere.w * sqrt(max(dot(axis_x, axis_x), max(dot(axis_y, axis_y), dot(axis_z, axis_z))));
+
+    bool visible = true;
+    for (int i = 0; i < 6; i++)
+        visible = visible && (dot(frustum_planes[i].xyz, center) + frustum_planes[i].w >= -radius);
+
+    bool draw = visible;
+    if (phase == phase_frustum) {
+        if (visible)
+            atomicAdd(frustum_visible_count, 1);
+    } else if (phase == phase_occlusion_first_pass) {
+        draw = visible && visibility[instance_index] != 0;
+    } else {
+        if (visible) {
+            atomicAdd(frustum_visible_count, 1);
+            if (is_occluded(center, radius)) {
+                atomicAdd(occluded_count, 1);
+                visible = false;
+            }
+        }
+        // Instances drawn in the first pass are not drawn again.
+        draw = visible && visibility[instance_index] == 0;
+        visibility[instance_index] = visible ? 1 : 0;
+    }
+
+    if (draw) {
+        if (phase == phase_occlusion_second_pass) {
+            uint draw_index = atomicAdd(second_pass_draw_count, 1);
+            draw_commands[instance_count + draw_index] = Draw_Command(index_count, 1, 0, 0, instance_index);
+        } else {
+            uint draw_index = atomicAdd(first_pass_draw_count, 1);
+            draw_commands[draw_index] = Draw_Command(index_count, 1, 0, 0, instance_index);
+        }
+    }
+}
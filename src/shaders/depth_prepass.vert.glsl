@@ -0,0 +1,26 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "common.glsl"
+
+// Position-only version of mesh.vert.glsl. gl_Position must be computed exactly as in mesh.vert.glsl
+// since the main pass that follows the depth pre-pass uses EQUAL depth test.
+layout(location=0) in vec4 in_position;
+
+layout(std140, binding=0) uniform Uniform_Block {
+    mat4x4 view_proj;
+    mat4x4 view;
+    mat4x4 model;
+};
+
+layout(std430, binding=2) readonly buffer Instance_Buffer {
+    Instance_Transform instance_transforms[];
+};
+
+invariant gl_Position;
+
+void main() {
+    Instance_Transform instance_transform = instance_transforms[gl_InstanceIndex];
+    vec3 world_position = transform_point(instance_transform, model * in_position);
+    gl_Position = view_proj * vec4(world_position, 1.0);
+}
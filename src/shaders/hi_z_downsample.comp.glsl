@@ -0,0 +1,121 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "common.glsl"
+
+// Single-pass downsampler. Each workgroup reduces a 32x32 tile of level 0 down to level 5 in
+// shared memory. The workgroup that finishes last computes the remaining levels from level 5.
+layout(local_size_x = 16, local_size_y = 16) in;
+
+const uint max_level_count = 13; // Hi_Z_Pyramid::max_level_count
+const uint tile_level_count = 6;
+
+layout(push_constant) uniform Push_Constants {
+    uvec2 depth_size;
+    uvec2 hi_z_size;
+    uint level_count;
+    uint group_count;
+};
+
+layout(binding=0) uniform sampler point_sampler;
+layout(binding=1) uniform texture2D depth_texture;
+layout(binding=2, r32f) uniform coherent image2D hi_z_levels[max_level_count];
+
+layout(std430, binding=3) coherent buffer Counter_Buffer {
+    uint finished_group_count;
+};
+
+shared float tile[16][16];
+shared bool is_last_group;
+
+// Level 0 texel covers depth texels [floor(p * scale), ceil((p + 1) * scale)), scale is in [1, 2).
+float reduce_depth(ivec2 p) {
+    vec2 scale = vec2(depth_size) / vec2(hi_z_size);
+    ivec2 p0 = ivec2(floor(vec2(p) * scale));
+    ivec2 p1 = min(ivec2(ceil(vec2(p + 1) * scale)), ivec2(depth_size)) - 1;
+
+    float d = 0.0;
+    for (int y = p0.y; y <= p1.y; y++) {
+        for (int x = p0.x; x <= p1.x; x++)
+            d = max(d, texelFetch(sampler2D(depth_texture, point_sampler), ivec2(x, y), 0).r);
+    }
+    return d;
+}
+
+ivec2 get_level_size(uint level) {
+    return max(ivec2(hi_z_size) >> level, ivec2(1));
+}
+
+void store(uint level, ivec2 p, float d) {
+    if (all(lessThan(p, get_level_size(level))))
+        imageStore(hi_z_levels[level], p, vec4(d));
+}
+
+void main() {
+    ivec2 t = ivec2(gl_LocalInvocationID.xy);
+    ivec2 group = ivec2(gl_WorkGroupID.xy);
+
+    // Levels 0 and 1: each thread reduces 2x2 texels of level 0.
+    {
+        ivec2 p = group * 32 + t * 2;
+        float d00 = reduce_depth(p);
+        float d10 = reduce_depth(p + ivec2(1, 0));
+        float d01 = reduce_depth(p + ivec2(0, 1));
+        float d11 = reduce_depth(p + ivec2(1, 1));
+        store(0, p, d00);
+        store(0, p + ivec2(1, 0), d10);
+        store(0, p + ivec2(0, 1), d01);
+        store(0, p + ivec2(1, 1), d11);
+
+        float d = max(max(d00, d10), max(d01, d11));
+        store(1, group * 16 + t, d);
+        tile[t.y][t.x] = d;
+    }
+    barrier();
+
+    // Levels 2..5 from shared memory.
+    for (uint level = 2, n = 8; level < min(level_count, tile_level_count); level++, n /= 2) {
+        float d = 0.0;
+        bool active = t.x < n && t.y < n;
+        if (active) {
+            d = max(max(tile[2*t.y][2*t.x], tile[2*t.y][2*t.x + 1]),
+                    max(tile[2*t.y + 1][2*t.x], tile[2*t.y + 1][2*t.x + 1]));
+        }
+        barrier();
+        if (active) {
+            tile[t.y][t.x] = d;
+            store(level, group * int(n) + t, d);
+        }
+        barrier();
+    }
+
+    if (level_count <= tile_level_count)
+        return;
+
+    // Make level 5 visible to the last workgroup.
+    memoryBarrierImage();
+    barrier();
+    if (gl_LocalInvocationIndex == 0)
+        is_last_group = (atomicAdd(finished_group_count, 1) == group_count - 1);
+    barrier();
+    if (!is_last_group)
+        return;
+
+    for (uint level = tile_level_count; level < level_count; level++) {
+        ivec2 size = get_level_size(level);
+        ivec2 src_max = get_level_size(level - 1) - 1;
+        for (int i = int(gl_LocalInvocationIndex); i < size.x * size.y; i += 256) {
+            ivec2 p = ivec2(i % size.x, i / size.x);
+            float d00 = imageLoad(hi_z_levels[level - 1], min(p * 2, src_max)).r;
+            float d10 = imageLoad(hi_z_levels[level - 1], min(p * 2 + ivec2(1, 0), src_max)).r;
+            float d01 = imageLoad(hi_z_levels[level - 1], min(p * 2 + ivec2(0, 1), src_max)).r;
+            float d11 = imageLoad(hi_z_levels[level - 1], min(p * 2 + ivec2(1, 1), src_max)).r;
+            imageStore(hi_z_levels[level], p, vec4(max(max(d00, d10), max(d01, d11))));
+        }
+        memoryBarrierImage();
+        barrier();
+    }
+
+    if (gl_LocalInvocationIndex == 0)
+        finished_group_count = 0;
+}
@@ -9,12 +9,24 @@ layout(location=2) in vec2 in_uv;
 layout(location = 0) out Frag_In frag_in;
 
 layout(std140, binding=0) uniform Uniform_Block {
-    mat4x4 model_view_proj;
-    mat4x4 model_view;
+    mat4x4 view_proj;
+    mat4x4 view;
+    mat4x4 model; // applied to each instance before its instance transform
 };
 
+layout(std430, binding=2) readonly buffer Instance_Buffer {
+    Instance_Transform instance_transforms[];
+};
+
+// Matches depth_prepass.vert.glsl for EQUAL depth test after the depth pre-pass.
+invariant gl_Position;
+
 void main() {
-    frag_in.normal = vec3(model_view * vec4(in_normal, 0.0));
+    Instance_Transform instance_transform = instance_transforms[gl_InstanceIndex];
+    vec3 world_position = transform_point(instance_transform, model * in_position);
+    vec3 world_normal = transform_vector(instance_transform, mat3(model) * in_normal);
+
+    frag_in.normal = mat3(view) * world_normal;
     frag_in.uv = in_uv;
-    gl_Position = model_view_proj * in_position;
+    gl_Position = view_proj * vec4(world_position, 1.0);
 }
@@ -0,0 +1,14 @@
+#version 460
+#extension GL_GOOGLE_include_directive : require
+
+#include "common.glsl"
+
+// Cheap shading that is used while the main mesh pipeline is being compiled.
+
+layout(location=0) in Frag_In frag_in;
+layout(location = 0) out vec4 color_attachment0;
+
+void main() {
+    float n_dot_v = abs(normalize(frag_in.normal).z);
+    color_attachment0 = vec4(srgb_encode(vec3(0.1 + 0.6 * n_dot_v)), 1);
+}
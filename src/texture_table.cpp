@@ -0,0 +1,78 @@
+#include "common.h"
+#include "texture_table.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+
+void Bindless_Texture_Table::create(uint32_t max_texture_count) {
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexing_properties { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT };
+    VkPhysicalDeviceProperties2 properties { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    properties.pNext = &indexing_properties;
+    vkGetPhysicalDeviceProperties2(vk.physical_device, &properties);
+
+    capacity = std::min({max_texture_count,
+        indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages,
+        indexing_properties.maxPerStageDescriptorUpdateAfterBindSampledImages});
+    texture_count = 0;
+    next_unused_index = 0;
+
+    set_layout = Descriptor_Set_Layout()
+        .sampled_image_array(0, capacity, VK_SHADER_STAGE_FRAGMENT_BIT)
+        .update_after_bind()
+        .create("bindless_texture_set_layout");
+
+    VkDescriptorPoolSize pool_size { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, capacity };
+    VkDescriptorPoolCreateInfo pool_create_info { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+    pool_create_info.flags          = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    pool_create_info.maxSets        = 1;
+    pool_create_info.poolSizeCount  = 1;
+    pool_create_info.pPoolSizes     = &pool_size;
+    VK_CHECK(vkCreateDescriptorPool(vk.device, &pool_create_info, nullptr, &descriptor_pool));
+    vk_set_debug_name(descriptor_pool, "bindless_texture_descriptor_pool");
+
+    VkDescriptorSetAllocateInfo alloc_info { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    alloc_info.descriptorPool     = descriptor_pool;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts        = &set_layout;
+    VK_CHECK(vkAllocateDescriptorSets(vk.device, &alloc_info, &set));
+    vk_set_debug_name(set, "bindless_texture_set");
+}
+
+void Bindless_Texture_Table::destroy() {
+    vkDestroyDescriptorPool(vk.device, descriptor_pool, nullptr);
+    vkDestroyDescriptorSetLayout(vk.device, set_layout, nullptr);
+    *this = Bindless_Texture_Table{};
+}
+
+uint32_t Bindless_Texture_Table::add_texture(VkImageView image_view) {
+    // The frame recorded when the index was retired is the last one that can access it. Only the
+    // frames in flight can be unfinished, even if this is called before vk_begin_frame waits.
+    auto it = std::remove_if(retired_indices.begin(), retired_indices.end(), [this](const auto& retired) {
+        if (vk.submitted_frame_count <= retired.first + std::size(vk.frame_fence))
+            return false;
+        free_indices.push_back(retired.second);
+        return true;
+    });
+    retired_indices.erase(it, retired_indices.end());
+
+    uint32_t index;
+    if (!free_indices.empty()) {
+        index = free_indices.back();
+        free_indices.pop_back();
+    } else {
+        if (next_unused_index == capacity)
+            error("Bindless_Texture_Table: too many textures, capacity is " + std::to_string(capacity));
+        index = next_unused_index++;
+    }
+
+    Descriptor_Writes(set).sampled_image(0, index, image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    texture_count++;
+    return index;
+}
+
+void Bindless_Texture_Table::remove_texture(uint32_t index) {
+    assert(index < next_unused_index);
+    retired_indices.push_back({vk.submitted_frame_count, index});
+    texture_count--;
+}
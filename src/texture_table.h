@@ -0,0 +1,30 @@
+#pragma once
+
+#include "vk.h"
+
+#include <utility>
+#include <vector>
+
+// Bindless table of sampled images. All textures are stored in one partially bound,
+// update-after-bind descriptor array, so the set is bound once and a draw selects
+// the texture by index (push constant or instance data). Texture index stays the same
+// while the texture is in the table.
+struct Bindless_Texture_Table {
+    VkDescriptorPool                descriptor_pool;
+    VkDescriptorSetLayout           set_layout;
+    VkDescriptorSet                 set;
+    uint32_t                        capacity;
+    uint32_t                        texture_count;
+    uint32_t                        next_unused_index;
+    std::vector<uint32_t>           free_indices;
+    std::vector<std::pair<uint64_t, uint32_t>> retired_indices; // (vk.submitted_frame_count, index)
+
+    void create(uint32_t max_texture_count);
+    void destroy();
+
+    // Can be called while frames that use the table are in flight.
+    uint32_t add_texture(VkImageView image_view);
+
+    // The index is reused only after the frames that could access it are finished.
+    void remove_texture(uint32_t index);
+};
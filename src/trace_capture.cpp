@@ -0,0 +1,159 @@
+#include "common.h"
+#include "cpu_profiler.h"
+#include "gpu_profiler.h"
+#include "trace_capture.h"
+#include "vk.h"
+
+#include <fstream>
+#include <iomanip>
+
+// The trace has two processes: CPU threads and the GPU queue.
+namespace {
+const int cpu_pid = 1;
+const int gpu_pid = 2;
+}
+
+void Trace_Capture::initialize() {
+    reference_cpu_ticks = read_cpu_ticks();
+    reference_time = Clock::now();
+
+    // Without the extension the alignment needs a submission and a wait, it is done
+    // once here while the queue is idle.
+    if (!vk.calibrated_timestamps_supported)
+        calibrate_gpu_clock();
+}
+
+void Trace_Capture::start(uint32_t frame_count, const std::string& file_name) {
+    if (is_active() || frame_count == 0)
+        return;
+
+    // Invariant TSC runs at a constant rate, the frequency is measured over the time
+    // since initialize instead of busy waiting.
+    const Clock::time_point time = Clock::now();
+    const uint64_t cpu_ticks = read_cpu_ticks();
+    const double elapsed_us = std::chrono::duration<double, std::micro>(time - reference_time).count();
+    if (elapsed_us > 0.0)
+        cpu_ticks_per_us = double(cpu_ticks - reference_cpu_ticks) / elapsed_us;
+
+    if (vk.calibrated_timestamps_supported)
+        calibrate_gpu_clock();
+    calibration_error_us = float(double(calibration_error_ticks) / cpu_ticks_per_us);
+
+    this->file_name = file_name;
+    this->frame_count = frame_count;
+    first_frame = vk.submitted_frame_count;
+    start_cpu_ticks = read_cpu_ticks();
+
+    gpu_profiler.begin_capture(first_frame, frame_count);
+    cpu_profiler.begin_capture();
+    state = State::recording;
+}
+
+void Trace_Capture::frame_submitted() {
+    if (state == State::recording && vk.submitted_frame_count >= first_frame + frame_count) {
+        cpu_profiler.end_capture();
+        state = State::waiting_for_gpu;
+    }
+    if (state == State::waiting_for_gpu && gpu_profiler.is_capture_complete()) {
+        if (write_trace())
+            last_file_name = file_name;
+        state = State::idle;
+    }
+}
+
+void Trace_Capture::calibrate_gpu_clock() {
+    uint64_t cpu_ticks_before, cpu_ticks_after;
+
+    // The device time domain is read between two rdtsc reads. Host time domains of the extension are
+    // not used because CPU scopes are timed with rdtsc, not with QPC or CLOCK_MONOTONIC.
+    if (vk.calibrated_timestamps_supported) {
+        VkCalibratedTimestampInfoEXT info { VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT };
+        info.timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+        uint64_t max_deviation;
+
+        cpu_ticks_before = read_cpu_ticks();
+        VK_CHECK(vkGetCalibratedTimestampsEXT(vk.device, 1, &info, &calibration_gpu_timestamp, &max_deviation));
+        cpu_ticks_after = read_cpu_ticks();
+    }
+    // Without the extension the timestamp is written by a separate submission, the alignment error
+    // includes submission and wait latency. Drift of the GPU clock since the calibration is not included.
+    else {
+        VkQueryPoolCreateInfo create_info { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        create_info.queryCount = 1;
+        VkQueryPool query_pool;
+        VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &query_pool));
+
+        cpu_ticks_before = read_cpu_ticks();
+        vk_execute(vk.command_pools[0], vk.queue, [query_pool](VkCommandBuffer command_buffer) {
+            vkCmdResetQueryPool(command_buffer, query_pool, 0, 1);
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+        });
+        cpu_ticks_after = read_cpu_ticks();
+
+        VK_CHECK(vkGetQueryPoolResults(vk.device, query_pool, 0, 1, sizeof(uint64_t), &calibration_gpu_timestamp,
+            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+        vkDestroyQueryPool(vk.device, query_pool, nullptr);
+    }
+
+    calibration_cpu_ticks = cpu_ticks_before + (cpu_ticks_after - cpu_ticks_before) / 2;
+    calibration_error_ticks = (cpu_ticks_after - cpu_ticks_before) / 2;
+}
+
+bool Trace_Capture::write_trace() const {
+    std::ofstream file(file_name);
+    if (!file) {
+        printf("failed to write trace: %s\n", file_name.c_str());
+        return false;
+    }
+    file << std::fixed << std::setprecision(3);
+
+    // Timestamps are in microseconds from the capture start.
+    auto cpu_ticks_to_us = [this](uint64_t ticks) {
+        return double(int64_t(ticks - start_cpu_ticks)) / cpu_ticks_per_us;
+    };
+    auto gpu_timestamp_to_us = [this, &cpu_ticks_to_us](uint64_t timestamp) {
+        return cpu_ticks_to_us(calibration_cpu_ticks) + double(int64_t(timestamp - calibration_gpu_timestamp)) * vk.timestamp_period_ms * 1000.0;
+    };
+
+    bool first_event = true;
+    auto begin_event = [&file, &first_event]() -> std::ofstream& {
+        file << (first_event ? "\n" : ",\n");
+        first_event = false;
+        return file;
+    };
+
+    file << "{\"traceEvents\": [";
+
+    begin_event() << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << cpu_pid << ", \"args\": {\"name\": \"CPU\"}}";
+    begin_event() << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << gpu_pid << ", \"args\": {\"name\": \"GPU\"}}";
+    begin_event() << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << gpu_pid << ", \"tid\": 0, \"args\": {\"name\": \"queue\"}}";
+
+    for (const CPU_Thread_Events* thread : cpu_profiler.get_threads()) {
+        const uint32_t event_count = cpu_profiler.get_captured_event_count(*thread);
+        if (event_count == 0)
+            continue;
+
+        begin_event() << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << cpu_pid << ", \"tid\": " << thread->thread_index
+            << ", \"args\": {\"name\": \"" << thread->thread_name << "\"}}";
+
+        for (uint32_t i = 0; i < event_count; i++) {
+            const CPU_Scope_Event& event = thread->events[i];
+            begin_event() << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": " << cpu_pid << ", \"tid\": " << thread->thread_index
+                << ", \"ts\": " << cpu_ticks_to_us(event.start_ticks) << ", \"dur\": " << double(event.end_ticks - event.start_ticks) / cpu_ticks_per_us << "}";
+        }
+        if (thread->dropped_event_count > 0)
+            printf("trace: %u events of %s were dropped\n", thread->dropped_event_count.load(), thread->thread_name.c_str());
+    }
+
+    for (const GPU_Trace_Scope& scope : gpu_profiler.captured_scopes) {
+        const double start_us = gpu_timestamp_to_us(scope.start_timestamp);
+        const double end_us = gpu_timestamp_to_us(scope.end_timestamp);
+        begin_event() << "{\"name\": \"" << gpu_profiler.nodes[scope.node].name << "\", \"ph\": \"X\", \"pid\": " << gpu_pid << ", \"tid\": 0"
+            << ", \"ts\": " << start_us << ", \"dur\": " << end_us - start_us
+            << ", \"args\": {\"frame\": " << scope.frame << ", \"path\": \"" << gpu_profiler.nodes[scope.node].path << "\"}}";
+    }
+
+    file << "\n], \"displayTimeUnit\": \"ms\"}\n";
+    return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Captures CPU scopes (CPU_TIME_SCOPE) and GPU scopes (GPU_TIME_SCOPE) of consecutive frames and
+// writes them as Chrome trace JSON that can be opened in chrome://tracing or ui.perfetto.dev.
+// GPU timestamps are placed on the CPU timeline with the calibration done when the capture starts,
+// or at initialization when VK_EXT_calibrated_timestamps is not supported.
+struct Trace_Capture {
+    enum class State {
+        idle,
+        recording,          // frames are being recorded
+        waiting_for_gpu     // GPU results of the captured frames are not read back yet
+    };
+
+    State       state = State::idle;
+    std::string last_file_name; // the most recent written trace
+    float       calibration_error_us = 0.f; // uncertainty of the GPU clock alignment
+
+    // Should be called after vk_initialize.
+    void initialize();
+
+    // Starts capture from the next recorded frame.
+    void start(uint32_t frame_count, const std::string& file_name);
+
+    // Should be called after each frame is submitted. Writes the trace when the results
+    // of all captured frames are available.
+    void frame_submitted();
+
+    bool is_active() const {
+        return state != State::idle;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void calibrate_gpu_clock();
+    bool write_trace() const;
+
+private:
+    std::string file_name;
+    uint64_t    first_frame = 0;
+    uint32_t    frame_count = 0;
+
+    double      cpu_ticks_per_us = 0.0;
+    uint64_t    start_cpu_ticks = 0;
+
+    // TSC frequency is measured from the ticks elapsed since this point.
+    uint64_t            reference_cpu_ticks = 0;
+    Clock::time_point   reference_time;
+
+    // GPU timestamp and CPU ticks taken at the same moment.
+    uint64_t    calibration_gpu_timestamp = 0;
+    uint64_t    calibration_cpu_ticks = 0;
+    uint64_t    calibration_error_ticks = 0;
+};
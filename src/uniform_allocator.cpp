@@ -0,0 +1,44 @@
+#include "common.h"
+#include "uniform_allocator.h"
+
+#include <algorithm>
+
+static VkDeviceSize align_up(VkDeviceSize offset, VkDeviceSize alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+void Uniform_Allocator::create(VkDeviceSize size_per_frame, uint32_t frame_count, const char* name) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(vk.physical_device, &properties);
+    alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 16);
+
+    region_size = align_up(size_per_frame, alignment);
+    region_begin = 0;
+    region_offset = 0;
+    max_used_size = 0;
+
+    void* ptr;
+    buffer = vk_create_host_visible_buffer(region_size * frame_count, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &ptr, name);
+    mapped_ptr = static_cast<uint8_t*>(ptr);
+}
+
+void Uniform_Allocator::destroy() {
+    buffer.destroy();
+    mapped_ptr = nullptr;
+}
+
+void Uniform_Allocator::begin_frame(uint32_t frame_index) {
+    max_used_size = std::max(max_used_size, region_offset);
+    region_begin = frame_index * region_size;
+    region_offset = 0;
+}
+
+void* Uniform_Allocator::allocate(VkDeviceSize size, uint32_t* dynamic_offset) {
+    VkDeviceSize offset = align_up(region_offset, alignment);
+    if (offset + size > region_size)
+        error("Uniform_Allocator: per-frame region is exhausted, increase size_per_frame");
+
+    region_offset = offset + size;
+    *dynamic_offset = static_cast<uint32_t>(region_begin + offset);
+    return mapped_ptr + region_begin + offset;
+}
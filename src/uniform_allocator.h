@@ -0,0 +1,32 @@
+#pragma once
+
+#include "vk.h"
+
+// Linear allocator for uniform data that changes every frame. The persistently mapped buffer
+// is split into regions, one per frame in flight. The frame allocates from its region, and
+// the region is reused when the frame fence of that frame slot is signaled. Allocations are
+// bound with VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC descriptors and dynamic offsets.
+struct Uniform_Allocator {
+    Vk_Buffer       buffer;
+    uint8_t*        mapped_ptr;
+    VkDeviceSize    alignment; // minUniformBufferOffsetAlignment
+    VkDeviceSize    region_size;
+    VkDeviceSize    region_begin;
+    VkDeviceSize    region_offset;
+    VkDeviceSize    max_used_size; // the largest amount of data allocated during a single frame
+
+    void create(VkDeviceSize size_per_frame, uint32_t frame_count, const char* name);
+    void destroy();
+
+    // Should be called after the frame fence of the frame slot is waited.
+    void begin_frame(uint32_t frame_index);
+
+    // Returns host pointer to write the data to. dynamic_offset is the offset to pass
+    // to vkCmdBindDescriptorSets.
+    void* allocate(VkDeviceSize size, uint32_t* dynamic_offset);
+
+    template <typename T>
+    T* allocate(uint32_t* dynamic_offset) {
+        return static_cast<T*>(allocate(sizeof(T), dynamic_offset));
+    }
+};
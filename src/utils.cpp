@@ -22,6 +22,12 @@ Descriptor_Writes& Descriptor_Writes::sampled_image(uint32_t binding, VkImageVie
     return *this;
 }
 
+Descriptor_Writes& Descriptor_Writes::sampled_image(uint32_t binding, uint32_t array_element, VkImageView image_view, VkImageLayout layout) {
+    sampled_image(binding, image_view, layout);
+    descriptor_writes[write_count - 1].dstArrayElement = array_element;
+    return *this;
+}
+
 Descriptor_Writes& Descriptor_Writes::storage_image(uint32_t binding, VkImageView image_view) {
     assert(write_count < max_writes);
     VkDescriptorImageInfo& image = resource_infos[write_count].image;
@@ -39,6 +45,12 @@ Descriptor_Writes& Descriptor_Writes::storage_image(uint32_t binding, VkImageVie
     return *this;
 }
 
+Descriptor_Writes& Descriptor_Writes::storage_image(uint32_t binding, uint32_t array_element, VkImageView image_view) {
+    storage_image(binding, image_view);
+    descriptor_writes[write_count - 1].dstArrayElement = array_element;
+    return *this;
+}
+
 Descriptor_Writes& Descriptor_Writes::sampler(uint32_t binding, VkSampler sampler) {
     assert(write_count < max_writes);
     VkDescriptorImageInfo& image = resource_infos[write_count].image;
@@ -72,6 +84,24 @@ Descriptor_Writes& Descriptor_Writes::uniform_buffer(uint32_t binding, VkBuffer
     return *this;
 }
 
+// Offset is specified with dynamic offset when the set is bound.
+Descriptor_Writes& Descriptor_Writes::uniform_buffer_dynamic(uint32_t binding, VkBuffer buffer_handle, VkDeviceSize range) {
+    assert(write_count < max_writes);
+    VkDescriptorBufferInfo& buffer = resource_infos[write_count].buffer;
+    buffer.buffer   = buffer_handle;
+    buffer.offset   = 0;
+    buffer.range    = range;
+
+    VkWriteDescriptorSet& write = descriptor_writes[write_count++];
+    write = VkWriteDescriptorSet { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    write.dstSet             = descriptor_set;
+    write.dstBinding         = binding;
+    write.descriptorCount    = 1;
+    write.descriptorType     = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write.pBufferInfo        = &buffer;
+    return *this;
+}
+
 Descriptor_Writes& Descriptor_Writes::storage_buffer(uint32_t binding, VkBuffer buffer_handle, VkDeviceSize offset, VkDeviceSize range) {
     assert(write_count < max_writes);
     VkDescriptorBufferInfo& buffer = resource_infos[write_count].buffer;
@@ -110,13 +140,21 @@ Descriptor_Writes& Descriptor_Writes::accelerator(uint32_t binding, VkAccelerati
 }
 
 void Descriptor_Writes::commit() {
-    assert(descriptor_set != VK_NULL_HANDLE);
     if (write_count > 0) {
+        assert(descriptor_set != VK_NULL_HANDLE);
         vkUpdateDescriptorSets(vk.device, write_count, descriptor_writes, 0, nullptr);
         write_count = 0;
     }
 }
 
+void Descriptor_Writes::push(VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout, uint32_t set) {
+    assert(vk.push_descriptors_supported);
+    if (write_count > 0) {
+        vkCmdPushDescriptorSetKHR(command_buffer, bind_point, pipeline_layout, set, write_count, descriptor_writes);
+        write_count = 0;
+    }
+}
+
 //
 // Descriptor_Set_Layout
 //
@@ -131,42 +169,93 @@ static VkDescriptorSetLayoutBinding get_set_layout_binding(uint32_t binding, VkD
 
 Descriptor_Set_Layout& Descriptor_Set_Layout::sampled_image(uint32_t binding, VkShaderStageFlags stage_flags) {
     assert(binding_count < max_bindings);
+    binding_flags[binding_count] = 0;
     bindings[binding_count++] = get_set_layout_binding(binding, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, stage_flags);
     return *this;
 }
 
 Descriptor_Set_Layout& Descriptor_Set_Layout::storage_image(uint32_t binding, VkShaderStageFlags stage_flags) {
     assert(binding_count < max_bindings);
+    binding_flags[binding_count] = 0;
     bindings[binding_count++] = get_set_layout_binding(binding, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, stage_flags);
     return *this;
 }
 
 Descriptor_Set_Layout& Descriptor_Set_Layout::sampler(uint32_t binding, VkShaderStageFlags stage_flags) {
     assert(binding_count < max_bindings);
+    binding_flags[binding_count] = 0;
     bindings[binding_count++] = get_set_layout_binding(binding, VK_DESCRIPTOR_TYPE_SAMPLER, stage_flags);
     return *this;
 }
 
 Descriptor_Set_Layout& Descriptor_Set_Layout::uniform_buffer(uint32_t binding, VkShaderStageFlags stage_flags) {
     assert(binding_count < max_bindings);
+    binding_flags[binding_count] = 0;
     bindings[binding_count++] = get_set_layout_binding(binding, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, stage_flags);
     return *this;
 }
 
+Descriptor_Set_Layout& Descriptor_Set_Layout::uniform_buffer_dynamic(uint32_t binding, VkShaderStageFlags stage_flags) {
+    assert(binding_count < max_bindings);
+    binding_flags[binding_count] = 0;
+    bindings[binding_count++] = get_set_layout_binding(binding, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, stage_flags);
+    return *this;
+}
+
 Descriptor_Set_Layout& Descriptor_Set_Layout::storage_buffer(uint32_t binding, VkShaderStageFlags stage_flags) {
     assert(binding_count < max_bindings);
+    binding_flags[binding_count] = 0;
     bindings[binding_count++] = get_set_layout_binding(binding, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, stage_flags);
     return *this;
 }
 
 Descriptor_Set_Layout& Descriptor_Set_Layout::accelerator(uint32_t binding, VkShaderStageFlags stage_flags) {
     assert(binding_count < max_bindings);
+    binding_flags[binding_count] = 0;
     bindings[binding_count++] = get_set_layout_binding(binding, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV, stage_flags);
     return *this;
 }
 
+Descriptor_Set_Layout& Descriptor_Set_Layout::sampled_image_array(uint32_t binding, uint32_t count, VkShaderStageFlags stage_flags) {
+    assert(binding_count < max_bindings);
+    binding_flags[binding_count] = 0;
+    bindings[binding_count] = get_set_layout_binding(binding, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, stage_flags);
+    bindings[binding_count++].descriptorCount = count;
+    return *this;
+}
+
+Descriptor_Set_Layout& Descriptor_Set_Layout::storage_image_array(uint32_t binding, uint32_t count, VkShaderStageFlags stage_flags) {
+    assert(binding_count < max_bindings);
+    binding_flags[binding_count] = 0;
+    bindings[binding_count] = get_set_layout_binding(binding, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, stage_flags);
+    bindings[binding_count++].descriptorCount = count;
+    return *this;
+}
+
+Descriptor_Set_Layout& Descriptor_Set_Layout::update_after_bind() {
+    assert(binding_count > 0);
+    binding_flags[binding_count - 1] =
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+        VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT |
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+    flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    return *this;
+}
+
+Descriptor_Set_Layout& Descriptor_Set_Layout::push_descriptors() {
+    assert(vk.push_descriptors_supported);
+    flags |= VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+    return *this;
+}
+
 VkDescriptorSetLayout Descriptor_Set_Layout::create(const char* name) {
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT binding_flags_info { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT };
+    binding_flags_info.bindingCount     = binding_count;
+    binding_flags_info.pBindingFlags    = binding_flags;
+
     VkDescriptorSetLayoutCreateInfo create_info { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+    create_info.pNext           = (flags & VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT) ? &binding_flags_info : nullptr;
+    create_info.flags           = flags;
     create_info.bindingCount    = binding_count;
     create_info.pBindings       = bindings;
 
@@ -176,51 +265,106 @@ VkDescriptorSetLayout Descriptor_Set_Layout::create(const char* name) {
     return set_layout;
 }
 
-void GPU_Time_Interval::begin() {
-    vkCmdWriteTimestamp(vk.command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index]);
+static VkDescriptorUpdateTemplate create_descriptor_update_template(const VkDescriptorSetLayoutBinding* bindings, uint32_t binding_count,
+    const VkDescriptorUpdateTemplateCreateInfo& base_create_info, const char* name)
+{
+    VkDescriptorUpdateTemplateEntry entries[Descriptor_Set_Layout::max_bindings];
+    for (uint32_t i = 0; i < binding_count; i++) {
+        assert(bindings[i].descriptorType != VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV);
+        assert(bindings[i].descriptorCount == 1);
+        entries[i] = VkDescriptorUpdateTemplateEntry{};
+        entries[i].dstBinding       = bindings[i].binding;
+        entries[i].descriptorCount  = bindings[i].descriptorCount;
+        entries[i].descriptorType   = bindings[i].descriptorType;
+        entries[i].offset           = i * sizeof(Descriptor_Template_Data::Info);
+        entries[i].stride           = sizeof(Descriptor_Template_Data::Info);
+    }
+
+    VkDescriptorUpdateTemplateCreateInfo create_info = base_create_info;
+    create_info.descriptorUpdateEntryCount  = binding_count;
+    create_info.pDescriptorUpdateEntries    = entries;
+
+    VkDescriptorUpdateTemplate update_template;
+    VK_CHECK(vkCreateDescriptorUpdateTemplate(vk.device, &create_info, nullptr, &update_template));
+    vk_set_debug_name(update_template, name);
+    return update_template;
 }
-void GPU_Time_Interval::end() {
-    vkCmdWriteTimestamp(vk.command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pool, start_query[vk.frame_index] + 1);
+
+VkDescriptorUpdateTemplate Descriptor_Set_Layout::create_update_template(VkDescriptorSetLayout set_layout, const char* name) {
+    VkDescriptorUpdateTemplateCreateInfo create_info { VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
+    create_info.templateType        = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+    create_info.descriptorSetLayout = set_layout;
+    return create_descriptor_update_template(bindings, binding_count, create_info, name);
 }
 
-GPU_Time_Interval* GPU_Time_Keeper::allocate_time_interval() {
-    assert(time_interval_count < max_time_intervals);
-    GPU_Time_Interval* time_interval = &time_intervals[time_interval_count++];
+VkDescriptorUpdateTemplate Descriptor_Set_Layout::create_push_update_template(VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout, uint32_t set, const char* name) {
+    assert(flags & VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR);
+    VkDescriptorUpdateTemplateCreateInfo create_info { VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
+    create_info.templateType        = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR;
+    create_info.pipelineBindPoint   = bind_point;
+    create_info.pipelineLayout      = pipeline_layout;
+    create_info.set                 = set;
+    return create_descriptor_update_template(bindings, binding_count, create_info, name);
+}
 
-    time_interval->start_query[0] = time_interval->start_query[1] = vk_allocate_timestamp_queries(2);
-    time_interval->length_ms = 0.f;
-    return time_interval;
+//
+// Descriptor_Template_Data
+//
+Descriptor_Template_Data& Descriptor_Template_Data::sampled_image(VkImageView image_view, VkImageLayout layout) {
+    assert(info_count < Descriptor_Set_Layout::max_bindings);
+    infos[info_count++].image = VkDescriptorImageInfo{ VK_NULL_HANDLE, image_view, layout };
+    return *this;
 }
 
-void GPU_Time_Keeper::initialize_time_intervals() {
-    vk_execute(vk.command_pools[0], vk.queue, [this](VkCommandBuffer command_buffer) {
-        vkCmdResetQueryPool(command_buffer, vk.timestamp_query_pools[0], 0, 2 * time_interval_count);
-        vkCmdResetQueryPool(command_buffer, vk.timestamp_query_pools[1], 0, 2 * time_interval_count);
-        for (uint32_t i = 0; i < time_interval_count; i++) {
-            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pools[0], time_intervals[i].start_query[0]);
-            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pools[0], time_intervals[i].start_query[0] + 1);
-            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pools[1], time_intervals[i].start_query[1]);
-            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, vk.timestamp_query_pools[1], time_intervals[i].start_query[1] + 1);
-        }
-    });
+Descriptor_Template_Data& Descriptor_Template_Data::storage_image(VkImageView image_view) {
+    assert(info_count < Descriptor_Set_Layout::max_bindings);
+    infos[info_count++].image = VkDescriptorImageInfo{ VK_NULL_HANDLE, image_view, VK_IMAGE_LAYOUT_GENERAL };
+    return *this;
 }
 
-void GPU_Time_Keeper::next_frame() {
-    uint64_t query_results[2/*query_result + availability*/ * 2/*start + end*/ * max_time_intervals];
-    const uint32_t query_count = 2 * time_interval_count;
-    VkResult result = vkGetQueryPoolResults(vk.device, vk.timestamp_query_pool, 0, query_count,
-        query_count * 2*sizeof(uint64_t), query_results, 2*sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
-    VK_CHECK_RESULT(result);
-    assert(result != VK_NOT_READY);
+Descriptor_Template_Data& Descriptor_Template_Data::sampler(VkSampler sampler) {
+    assert(info_count < Descriptor_Set_Layout::max_bindings);
+    infos[info_count++].image = VkDescriptorImageInfo{ sampler, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED };
+    return *this;
+}
 
-    const float influence = 0.25f;
+Descriptor_Template_Data& Descriptor_Template_Data::uniform_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    assert(info_count < Descriptor_Set_Layout::max_bindings);
+    infos[info_count++].buffer = VkDescriptorBufferInfo{ buffer, offset, range };
+    return *this;
+}
 
-    for (uint32_t i = 0; i < time_interval_count; i++) {
-        assert(query_results[4*i + 2] >= query_results[4*i]);
-        time_intervals[i].length_ms = (1.f-influence) * time_intervals[i].length_ms + influence * float(double(query_results[4*i + 2] - query_results[4*i]) * vk.timestamp_period_ms);
-    }
+Descriptor_Template_Data& Descriptor_Template_Data::storage_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    assert(info_count < Descriptor_Set_Layout::max_bindings);
+    infos[info_count++].buffer = VkDescriptorBufferInfo{ buffer, offset, range };
+    return *this;
+}
+
+//
+// Specialization_Constants
+//
+Specialization_Constants& Specialization_Constants::uint32(uint32_t constant_id, uint32_t value) {
+    assert(constant_count < max_constants);
+    VkSpecializationMapEntry& entry = entries[constant_count];
+    entry.constantID    = constant_id;
+    entry.offset        = constant_count * sizeof(uint32_t);
+    entry.size          = sizeof(uint32_t);
+    values[constant_count++] = value;
+    return *this;
+}
+
+Specialization_Constants& Specialization_Constants::float32(uint32_t constant_id, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(float));
+    return uint32(constant_id, bits);
+}
 
-    vkCmdResetQueryPool(vk.command_buffer, vk.timestamp_query_pool, 0, query_count);
+const VkSpecializationInfo* Specialization_Constants::get_info() {
+    info.mapEntryCount  = constant_count;
+    info.pMapEntries    = entries;
+    info.dataSize       = constant_count * sizeof(uint32_t);
+    info.pData          = values;
+    return &info;
 }
 
 void begin_gpu_marker_scope(VkCommandBuffer command_buffer, const char* name) {
@@ -5,6 +5,12 @@
 
 #include <vector>
 
+// How descriptors are provided for a draw or dispatch.
+enum class Descriptor_Backend : int {
+    descriptor_sets,    // set is allocated from the per-frame allocator and updated with a template
+    push_descriptors    // VK_KHR_push_descriptor, falls back to descriptor_sets if not supported
+};
+
 struct Descriptor_Writes {
     static constexpr uint32_t max_writes = 32;
 
@@ -33,70 +39,96 @@ struct Descriptor_Writes {
     }
 
     Descriptor_Writes& sampled_image    (uint32_t binding, VkImageView image_view, VkImageLayout layout);
+    Descriptor_Writes& sampled_image    (uint32_t binding, uint32_t array_element, VkImageView image_view, VkImageLayout layout);
     Descriptor_Writes& storage_image    (uint32_t binding, VkImageView image_view);
+    Descriptor_Writes& storage_image    (uint32_t binding, uint32_t array_element, VkImageView image_view);
     Descriptor_Writes& sampler          (uint32_t binding, VkSampler sampler);
     Descriptor_Writes& uniform_buffer   (uint32_t binding, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+    Descriptor_Writes& uniform_buffer_dynamic(uint32_t binding, VkBuffer buffer, VkDeviceSize range);
     Descriptor_Writes& storage_buffer   (uint32_t binding, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
     Descriptor_Writes& accelerator      (uint32_t binding, VkAccelerationStructureNV acceleration_structure);
     void commit();
+
+    // Records the writes into the command buffer with vkCmdPushDescriptorSetKHR instead of updating
+    // the descriptor set. Requires the set layout created with Descriptor_Set_Layout::push_descriptors().
+    void push(VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout, uint32_t set);
 };
 
 struct Descriptor_Set_Layout {
     static constexpr uint32_t max_bindings = 32;
 
     VkDescriptorSetLayoutBinding bindings[max_bindings];
+    VkDescriptorBindingFlagsEXT binding_flags[max_bindings];
     uint32_t binding_count;
+    VkDescriptorSetLayoutCreateFlags flags;
 
     Descriptor_Set_Layout() {
         binding_count = 0;
+        flags = 0;
     }
 
     Descriptor_Set_Layout& sampled_image    (uint32_t binding, VkShaderStageFlags stage_flags);
     Descriptor_Set_Layout& storage_image    (uint32_t binding, VkShaderStageFlags stage_flags);
     Descriptor_Set_Layout& sampler          (uint32_t binding, VkShaderStageFlags stage_flags);
     Descriptor_Set_Layout& uniform_buffer   (uint32_t binding, VkShaderStageFlags stage_flags);
+    Descriptor_Set_Layout& uniform_buffer_dynamic(uint32_t binding, VkShaderStageFlags stage_flags);
     Descriptor_Set_Layout& storage_buffer   (uint32_t binding, VkShaderStageFlags stage_flags);
     Descriptor_Set_Layout& accelerator      (uint32_t binding, VkShaderStageFlags stage_flags);
+    Descriptor_Set_Layout& sampled_image_array(uint32_t binding, uint32_t count, VkShaderStageFlags stage_flags);
+    Descriptor_Set_Layout& storage_image_array(uint32_t binding, uint32_t count, VkShaderStageFlags stage_flags);
+    Descriptor_Set_Layout& push_descriptors (); // VK_KHR_push_descriptor layout, sets can't be allocated
+
+    // Makes the last added binding partially bound and updatable after the set is bound, and also
+    // while the set is in use for descriptors that are not accessed (VK_EXT_descriptor_indexing).
+    // Sets with such layout must be allocated from VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT pool.
+    Descriptor_Set_Layout& update_after_bind();
     VkDescriptorSetLayout create(const char* name);
-};
 
-//
-// GPU time queries.
-//
-struct GPU_Time_Interval {
-    uint32_t start_query[2]; // end query == (start_query[frame_index] + 1)
-    float length_ms;
-
-    void begin();
-    void end();
+    // Update templates read descriptors from Descriptor_Template_Data. The first template updates
+    // descriptor sets, the second one is used with vkCmdPushDescriptorSetWithTemplateKHR.
+    VkDescriptorUpdateTemplate create_update_template(VkDescriptorSetLayout set_layout, const char* name);
+    VkDescriptorUpdateTemplate create_push_update_template(VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout, uint32_t set, const char* name);
 };
 
-struct GPU_Time_Keeper {
-    static constexpr uint32_t max_time_intervals = 128;
+// Descriptors in the order the bindings were added to Descriptor_Set_Layout.
+struct Descriptor_Template_Data {
+    union Info {
+        VkDescriptorImageInfo   image;
+        VkDescriptorBufferInfo  buffer;
+    };
+
+    Info        infos[Descriptor_Set_Layout::max_bindings];
+    uint32_t    info_count;
 
-    GPU_Time_Interval time_intervals[max_time_intervals];
-    uint32_t time_interval_count;
+    Descriptor_Template_Data() {
+        info_count = 0;
+    }
 
-    GPU_Time_Interval* allocate_time_interval();
-    void initialize_time_intervals();
-    void next_frame();
+    Descriptor_Template_Data& sampled_image    (VkImageView image_view, VkImageLayout layout);
+    Descriptor_Template_Data& storage_image    (VkImageView image_view);
+    Descriptor_Template_Data& sampler          (VkSampler sampler);
+    Descriptor_Template_Data& uniform_buffer   (VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+    Descriptor_Template_Data& storage_buffer   (VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
 };
 
-struct GPU_Time_Scope {
-    GPU_Time_Scope(GPU_Time_Interval* time_interval) {
-        this->time_interval = time_interval;
-        time_interval->begin();
-    }
-    ~GPU_Time_Scope() {
-        time_interval->end();
+struct Specialization_Constants {
+    static constexpr uint32_t max_constants = 16;
+
+    VkSpecializationMapEntry    entries[max_constants];
+    uint32_t                    values[max_constants];
+    uint32_t                    constant_count;
+    VkSpecializationInfo        info;
+
+    Specialization_Constants() {
+        constant_count = 0;
     }
 
-private:
-    GPU_Time_Interval* time_interval;
+    // Sets 32-bit value (int, uint, float or bool) of the constant with constant_id.
+    Specialization_Constants& uint32    (uint32_t constant_id, uint32_t value);
+    Specialization_Constants& float32   (uint32_t constant_id, float value);
+    const VkSpecializationInfo* get_info();
 };
 
-#define GPU_TIME_SCOPE(time_interval) GPU_Time_Scope gpu_time_scope##__LINE__(time_interval)
-
 //
 // GPU debug markers.
 //
@@ -3,6 +3,7 @@
 #define VMA_IMPLEMENTATION
 #include "vk.h"
 
+#include "cpu_profiler.h"
 #include "platform.h"
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -14,15 +15,19 @@
 #include <iostream>
 #include <vector>
 
-static const VkDescriptorPoolSize descriptor_pool_sizes[] = {
-    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,             16},
-    {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,              16},
-    {VK_DESCRIPTOR_TYPE_SAMPLER,                    16},
-    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,              16},
+// Descriptor pool capacity is defined as the number of descriptors of each type per set.
+static const VkDescriptorPoolSize descriptors_per_set[] = {
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,             1},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,     1},
+    {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,              2},
+    {VK_DESCRIPTOR_TYPE_SAMPLER,                    1},
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,     1},
+    {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,              1},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,             1},
 };
 
-constexpr uint32_t max_descriptor_sets = 64;
-constexpr uint32_t max_timestamp_queries = 64;
+constexpr uint32_t persistent_sets_per_pool = 64;
+constexpr uint32_t frame_sets_per_pool = 256;
 
 //
 // Vk_Instance is a container that stores common Vulkan resources like vulkan instance,
@@ -30,7 +35,8 @@ constexpr uint32_t max_timestamp_queries = 64;
 //
 Vk_Instance vk;
 
-static void create_swapchain(bool vsync) {
+// old_swapchain is the swapchain being replaced, the presentation engine can reuse its resources.
+static void create_swapchain(bool vsync, VkSwapchainKHR old_swapchain = VK_NULL_HANDLE) {
     assert(vk.swapchain_info.handle == VK_NULL_HANDLE);
 
     VkSurfaceCapabilitiesKHR surface_caps;
@@ -88,6 +94,7 @@ static void create_swapchain(bool vsync) {
     desc.compositeAlpha     = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     desc.presentMode        = present_mode;
     desc.clipped            = VK_TRUE;
+    desc.oldSwapchain       = old_swapchain;
 
     VK_CHECK(vkCreateSwapchainKHR(vk.device, &desc, nullptr, &vk.swapchain_info.handle));
 
@@ -245,6 +252,51 @@ static void create_device(GLFWwindow* window) {
                 error("Vulkan: required device extension is not available: " + std::string(required_extension));
         }
 
+        vk.push_descriptors_supported = is_extension_supported(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+        if (vk.push_descriptors_supported)
+            device_extensions.push_back(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME);
+
+        vk.draw_indirect_count_supported = is_extension_supported(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        if (vk.draw_indirect_count_supported)
+            device_extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
+        // Only the device time domain is used, it is correlated with the CPU clock by the caller.
+        vk.calibrated_timestamps_supported = false;
+        if (is_extension_supported(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME)) {
+            uint32_t domain_count;
+            VK_CHECK(vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(vk.physical_device, &domain_count, nullptr));
+            std::vector<VkTimeDomainEXT> domains(domain_count);
+            VK_CHECK(vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(vk.physical_device, &domain_count, domains.data()));
+            vk.calibrated_timestamps_supported = std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != domains.end();
+        }
+        if (vk.calibrated_timestamps_supported)
+            device_extensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+
+        // Descriptor indexing is required for the bindless texture table.
+        if (!is_extension_supported(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME))
+            error("Vulkan: required device extension is not available: " + std::string(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME));
+        device_extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported_indexing_features { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT };
+        VkPhysicalDeviceFeatures2 supported_features { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+        supported_features.pNext = &supported_indexing_features;
+        vkGetPhysicalDeviceFeatures2(vk.physical_device, &supported_features);
+
+        if (!supported_indexing_features.runtimeDescriptorArray ||
+            !supported_indexing_features.descriptorBindingPartiallyBound ||
+            !supported_indexing_features.descriptorBindingSampledImageUpdateAfterBind ||
+            !supported_indexing_features.descriptorBindingUpdateUnusedWhilePending)
+        {
+            error("Vulkan: descriptor indexing features required for bindless textures are not supported");
+        }
+
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT };
+        indexing_features.runtimeDescriptorArray                        = VK_TRUE;
+        indexing_features.descriptorBindingPartiallyBound               = VK_TRUE;
+        indexing_features.descriptorBindingSampledImageUpdateAfterBind  = VK_TRUE;
+        indexing_features.descriptorBindingUpdateUnusedWhilePending     = VK_TRUE;
+        indexing_features.shaderSampledImageArrayNonUniformIndexing     = supported_indexing_features.shaderSampledImageArrayNonUniformIndexing;
+
         const float priority = 1.0;
         VkDeviceQueueCreateInfo queue_desc { VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO };
         queue_desc.queueFamilyIndex = vk.queue_family_index;
@@ -254,7 +306,19 @@ static void create_device(GLFWwindow* window) {
         VkPhysicalDeviceFeatures features {};
         features.vertexPipelineStoresAndAtomics = VK_TRUE; // to shut up improper validation warning (image store is in the raygen shader not in the vertex stage)
 
+        // Indirect draws generated by GPU culling address instances with firstInstance.
+        vk.multi_draw_indirect_supported = supported_features.features.multiDrawIndirect && supported_features.features.drawIndirectFirstInstance;
+        features.multiDrawIndirect          = vk.multi_draw_indirect_supported;
+        features.drawIndirectFirstInstance  = vk.multi_draw_indirect_supported;
+
+        vk.storage_image_array_indexing_supported = supported_features.features.shaderStorageImageArrayDynamicIndexing;
+        features.shaderStorageImageArrayDynamicIndexing = vk.storage_image_array_indexing_supported;
+
+        vk.pipeline_statistics_supported = supported_features.features.pipelineStatisticsQuery;
+        features.pipelineStatisticsQuery = vk.pipeline_statistics_supported;
+
         VkDeviceCreateInfo device_desc { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
+        device_desc.pNext                   = &indexing_features;
         device_desc.queueCreateInfoCount    = 1;
         device_desc.pQueueCreateInfos       = &queue_desc;
         device_desc.enabledExtensionCount   = (uint32_t)device_extensions.size();
@@ -265,21 +329,65 @@ static void create_device(GLFWwindow* window) {
     }
 }
 
-static void create_depth_buffer() {
-    // choose depth image format
-    {
-        VkFormat candidates[2] = { VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D32_SFLOAT_S8_UINT };
-        for (auto format : candidates) {
+static VkFormat choose_depth_format(bool stencil) {
+    const VkFormat stencil_candidates[] = { VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D32_SFLOAT_S8_UINT };
+    const VkFormat depth_candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32 };
+
+    // Depth-only formats save the stencil plane. If none is supported use the format with stencil.
+    for (int pass = stencil ? 1 : 0; pass < 2; pass++) {
+        const VkFormat* begin = (pass == 0) ? std::begin(depth_candidates) : std::begin(stencil_candidates);
+        const VkFormat* end = (pass == 0) ? std::end(depth_candidates) : std::end(stencil_candidates);
+        for (const VkFormat* format = begin; format != end; ++format) {
             VkFormatProperties props;
-            vkGetPhysicalDeviceFormatProperties(vk.physical_device, format, &props);
-            if ((props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) != 0) {
-                vk.depth_info.format = format;
-                break;
-            }
+            vkGetPhysicalDeviceFormatProperties(vk.physical_device, *format, &props);
+            if ((props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) != 0)
+                return *format;
         }
-        if (vk.depth_info.format == VK_FORMAT_UNDEFINED)
-            error("failed to choose depth attachment format");
     }
+    error("failed to choose depth attachment format");
+    return VK_FORMAT_UNDEFINED;
+}
+
+static bool has_lazily_allocated_memory() {
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(vk.physical_device, &memory_properties);
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+        if (memory_properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+            return true;
+    }
+    return false;
+}
+
+// Memory requirements of the depth buffer without transient policy are measured once with
+// a temporary image of the initial surface size, the savings at other sizes are estimated from it.
+static void measure_depth_baseline() {
+    VkImageCreateInfo create_info { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+    create_info.imageType       = VK_IMAGE_TYPE_2D;
+    create_info.format          = choose_depth_format(true);
+    create_info.extent.width    = std::max(vk.surface_size.width, 1u);
+    create_info.extent.height   = std::max(vk.surface_size.height, 1u);
+    create_info.extent.depth    = 1;
+    create_info.mipLevels       = 1;
+    create_info.arrayLayers     = 1;
+    create_info.samples         = VK_SAMPLE_COUNT_1_BIT;
+    create_info.tiling          = VK_IMAGE_TILING_OPTIMAL;
+    create_info.usage           = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    create_info.sharingMode     = VK_SHARING_MODE_EXCLUSIVE;
+    create_info.initialLayout   = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkImage image;
+    VK_CHECK(vkCreateImage(vk.device, &create_info, nullptr, &image));
+    VkMemoryRequirements memory_requirements;
+    vkGetImageMemoryRequirements(vk.device, image, &memory_requirements);
+    vkDestroyImage(vk.device, image, nullptr);
+    vk.depth_baseline_bytes_per_pixel = double(memory_requirements.size) / (double(create_info.extent.width) * create_info.extent.height);
+}
+
+static void create_depth_buffer() {
+    vk.depth_info.format = choose_depth_format(vk.depth_policy.stencil);
+    vk.depth_info.has_stencil = vk.depth_info.format != VK_FORMAT_D32_SFLOAT && vk.depth_info.format != VK_FORMAT_X8_D24_UNORM_PACK32;
+    vk.depth_info.transient = vk.depth_policy.transient;
+    vk.depth_info.lazily_allocated = vk.depth_info.transient && has_lazily_allocated_memory();
 
     // create depth image
     {
@@ -293,14 +401,27 @@ static void create_depth_buffer() {
         create_info.arrayLayers     = 1;
         create_info.samples         = VK_SAMPLE_COUNT_1_BIT;
         create_info.tiling          = VK_IMAGE_TILING_OPTIMAL;
-        create_info.usage           = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
         create_info.sharingMode     = VK_SHARING_MODE_EXCLUSIVE;
         create_info.initialLayout   = VK_IMAGE_LAYOUT_UNDEFINED;
 
+        // Non-transient depth is stored and sampled to build Hi-Z pyramid.
+        if (vk.depth_info.transient)
+            create_info.usage       = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        else
+            create_info.usage       = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+        // Dedicated allocation lets vkGetDeviceMemoryCommitment report the memory of this image only.
         VmaAllocationCreateInfo alloc_create_info{};
         alloc_create_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        if (vk.depth_info.lazily_allocated) {
+            alloc_create_info.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+            alloc_create_info.requiredFlags = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        }
 
-        VK_CHECK(vmaCreateImage(vk.allocator, &create_info, &alloc_create_info, &vk.depth_info.image, &vk.depth_info.allocation, nullptr));
+        VmaAllocationInfo allocation_info;
+        VK_CHECK(vmaCreateImage(vk.allocator, &create_info, &alloc_create_info, &vk.depth_info.image, &vk.depth_info.allocation, &allocation_info));
+        vk.depth_info.memory_size = allocation_info.size;
+        vk.depth_info.baseline_memory_size = VkDeviceSize(vk.depth_baseline_bytes_per_pixel * vk.surface_size.width * vk.surface_size.height);
     }
 
     // create depth image view
@@ -319,17 +440,6 @@ static void create_depth_buffer() {
         VK_CHECK(vkCreateImageView(vk.device, &desc, nullptr, &vk.depth_info.image_view));
     }
 
-    VkImageSubresourceRange subresource_range{};
-    subresource_range.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-    subresource_range.levelCount = 1;
-    subresource_range.layerCount = 1;
-
-    vk_execute(vk.command_pools[0], vk.queue, [&subresource_range](VkCommandBuffer command_buffer) {
-        vk_cmd_image_barrier_for_subresource(command_buffer, vk.depth_info.image, subresource_range,
-            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-            0, 0,
-            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-    });
 }
 
 static void destroy_depth_buffer() {
@@ -338,6 +448,40 @@ static void destroy_depth_buffer() {
     vk.depth_info = Depth_Buffer_Info{};
 }
 
+static void destroy_retired_object(const Vk_Retired_Object& object) {
+    switch (object.type) {
+    case VK_OBJECT_TYPE_PIPELINE:
+        vkDestroyPipeline(vk.device, (VkPipeline)object.handle, nullptr);
+        break;
+    case VK_OBJECT_TYPE_IMAGE_VIEW:
+        vkDestroyImageView(vk.device, (VkImageView)object.handle, nullptr);
+        break;
+    case VK_OBJECT_TYPE_FRAMEBUFFER:
+        vkDestroyFramebuffer(vk.device, (VkFramebuffer)object.handle, nullptr);
+        break;
+    case VK_OBJECT_TYPE_SAMPLER:
+        vkDestroySampler(vk.device, (VkSampler)object.handle, nullptr);
+        break;
+    case VK_OBJECT_TYPE_BUFFER_VIEW:
+        vkDestroyBufferView(vk.device, (VkBufferView)object.handle, nullptr);
+        break;
+    case VK_OBJECT_TYPE_SWAPCHAIN_KHR:
+        vkDestroySwapchainKHR(vk.device, (VkSwapchainKHR)object.handle, nullptr);
+        break;
+    case VK_OBJECT_TYPE_IMAGE:
+        vmaDestroyImage(vk.allocator, (VkImage)object.handle, object.allocation);
+        break;
+    case VK_OBJECT_TYPE_BUFFER:
+        vmaDestroyBuffer(vk.allocator, (VkBuffer)object.handle, object.allocation);
+        break;
+    case VK_OBJECT_TYPE_DESCRIPTOR_SET:
+        object.descriptor_allocator->free(object.set_layout, (VkDescriptorSet)object.handle);
+        break;
+    default:
+        assert(!"unsupported retired object type");
+    }
+}
+
 static VKAPI_ATTR VkBool32 VKAPI_CALL debug_utils_messenger_callback(
     VkDebugUtilsMessageSeverityFlagBitsEXT          message_severity,
     VkDebugUtilsMessageTypeFlagsEXT                 message_type,
@@ -366,7 +510,89 @@ void Vk_Buffer::destroy() {
     *this = Vk_Buffer{};
 }
 
-void vk_initialize(GLFWwindow* window, bool enable_validation_layers) {
+void Vk_Descriptor_Allocator::create(uint32_t sets_per_pool, const char* name) {
+    this->sets_per_pool = sets_per_pool;
+    this->name = name;
+    current_pool = 0;
+    allocated_set_count = 0;
+    max_allocated_set_count = 0;
+    create_pool();
+}
+
+void Vk_Descriptor_Allocator::destroy() {
+    for (VkDescriptorPool pool : pools)
+        vkDestroyDescriptorPool(vk.device, pool, nullptr);
+    *this = Vk_Descriptor_Allocator{};
+}
+
+void Vk_Descriptor_Allocator::create_pool() {
+    VkDescriptorPoolSize pool_sizes[std::size(descriptors_per_set)];
+    for (size_t i = 0; i < std::size(descriptors_per_set); i++) {
+        pool_sizes[i].type = descriptors_per_set[i].type;
+        pool_sizes[i].descriptorCount = descriptors_per_set[i].descriptorCount * sets_per_pool;
+    }
+    VkDescriptorPoolCreateInfo desc{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+    desc.maxSets = sets_per_pool;
+    desc.poolSizeCount = (uint32_t)std::size(pool_sizes);
+    desc.pPoolSizes = pool_sizes;
+
+    VkDescriptorPool pool;
+    VK_CHECK(vkCreateDescriptorPool(vk.device, &desc, nullptr, &pool));
+    vk_set_debug_name(pool, (name + "_" + std::to_string(pools.size())).c_str());
+    pools.push_back(pool);
+}
+
+VkDescriptorSet Vk_Descriptor_Allocator::allocate(VkDescriptorSetLayout set_layout) {
+    VkDescriptorSetAllocateInfo alloc_info { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts        = &set_layout;
+
+    for (size_t i = 0; i < free_sets.size(); i++) {
+        if (free_sets[i].first == set_layout) {
+            VkDescriptorSet set = free_sets[i].second;
+            free_sets[i] = free_sets.back();
+            free_sets.pop_back();
+            return set;
+        }
+    }
+
+    VkDescriptorSet set;
+    bool empty_pool = false; // pools after current_pool have no allocations
+    while (true) {
+        alloc_info.descriptorPool = pools[current_pool];
+        VkResult result = vkAllocateDescriptorSets(vk.device, &alloc_info, &set);
+        if (result == VK_SUCCESS)
+            break;
+
+        if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)
+            VK_CHECK_RESULT(result);
+
+        if (empty_pool)
+            error("Vulkan: descriptor set layout needs more descriptors than " + name + " pool provides");
+
+        if (++current_pool == pools.size())
+            create_pool();
+        empty_pool = true;
+    }
+    allocated_set_count++;
+    max_allocated_set_count = std::max(max_allocated_set_count, allocated_set_count);
+    return set;
+}
+
+void Vk_Descriptor_Allocator::free(VkDescriptorSetLayout set_layout, VkDescriptorSet set) {
+    free_sets.push_back({set_layout, set});
+}
+
+void Vk_Descriptor_Allocator::reset() {
+    for (uint32_t i = 0; i <= current_pool; i++)
+        VK_CHECK(vkResetDescriptorPool(vk.device, pools[i], 0));
+    current_pool = 0;
+    allocated_set_count = 0;
+    free_sets.clear();
+}
+
+void vk_initialize(GLFWwindow* window, bool enable_validation_layers, const Depth_Buffer_Policy& depth_policy) {
+    vk.depth_policy = depth_policy;
     VK_CHECK(volkInitialize());
     uint32_t instance_version = volkGetInstanceVersion();
 
@@ -461,19 +687,19 @@ void vk_initialize(GLFWwindow* window, bool enable_validation_layers) {
         VK_CHECK(vkAllocateCommandBuffers(vk.device, &alloc_info, &vk.command_buffers[1]));
     }
 
-    // Descriptor pool.
+    // Descriptor allocators.
     {
-        std::vector<VkDescriptorPoolSize> pool_sizes;
-        for (size_t i = 0; i < std::size(descriptor_pool_sizes); i++) {
-            pool_sizes.push_back(descriptor_pool_sizes[i]);
-        }
-        VkDescriptorPoolCreateInfo desc{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
-        desc.maxSets = max_descriptor_sets;
-        desc.poolSizeCount = (uint32_t)pool_sizes.size();
-        desc.pPoolSizes = pool_sizes.data();
+        vk.descriptor_allocator.create(persistent_sets_per_pool, "descriptor_pool");
+        vk.frame_descriptor_allocators[0].create(frame_sets_per_pool, "frame_descriptor_pool_0");
+        vk.frame_descriptor_allocators[1].create(frame_sets_per_pool, "frame_descriptor_pool_1");
+        vk.frame_descriptor_allocator = &vk.frame_descriptor_allocators[vk.frame_index];
+    }
 
-        VK_CHECK(vkCreateDescriptorPool(vk.device, &desc, nullptr, &vk.descriptor_pool));
-        vk_set_debug_name(vk.descriptor_pool, "descriptor_pool");
+    // Pipeline cache.
+    {
+        VkPipelineCacheCreateInfo desc{ VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+        VK_CHECK(vkCreatePipelineCache(vk.device, &desc, nullptr, &vk.pipeline_cache));
+        vk_set_debug_name(vk.pipeline_cache, "pipeline_cache");
     }
 
     // Select surface format.
@@ -511,36 +737,33 @@ void vk_initialize(GLFWwindow* window, bool enable_validation_layers) {
     }
 
     create_swapchain(true);
+    measure_depth_baseline();
     create_depth_buffer();
-
-    // Query pool.
-    {
-        VkQueryPoolCreateInfo create_info { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
-        create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
-        create_info.queryCount = max_timestamp_queries;
-        VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &vk.timestamp_query_pools[0]));
-        VK_CHECK(vkCreateQueryPool(vk.device, &create_info, nullptr, &vk.timestamp_query_pools[1]));
-    }
 }
 
 void vk_shutdown() {
     vkDeviceWaitIdle(vk.device);
 
+    for (const Vk_Retired_Object& retired : vk.retired_objects)
+        destroy_retired_object(retired);
+    vk.retired_objects.clear();
+
     if (vk.staging_buffer != VK_NULL_HANDLE) {
         vmaDestroyBuffer(vk.allocator, vk.staging_buffer, vk.staging_buffer_allocation);
     }
 
     vkDestroyCommandPool(vk.device, vk.command_pools[0], nullptr);
     vkDestroyCommandPool(vk.device, vk.command_pools[1], nullptr);
-    vkDestroyDescriptorPool(vk.device, vk.descriptor_pool, nullptr);
+    vk.descriptor_allocator.destroy();
+    vk.frame_descriptor_allocators[0].destroy();
+    vk.frame_descriptor_allocators[1].destroy();
+    vkDestroyPipelineCache(vk.device, vk.pipeline_cache, nullptr);
     vkDestroySemaphore(vk.device, vk.image_acquired_semaphore[0], nullptr);
     vkDestroySemaphore(vk.device, vk.image_acquired_semaphore[1], nullptr);
     vkDestroySemaphore(vk.device, vk.rendering_finished_semaphore[0], nullptr);
     vkDestroySemaphore(vk.device, vk.rendering_finished_semaphore[1], nullptr);
     vkDestroyFence(vk.device, vk.frame_fence[0], nullptr);
     vkDestroyFence(vk.device, vk.frame_fence[1], nullptr);
-    vkDestroyQueryPool(vk.device, vk.timestamp_query_pools[0], nullptr);
-    vkDestroyQueryPool(vk.device, vk.timestamp_query_pools[1], nullptr);
     destroy_swapchain();
     destroy_depth_buffer();
     vmaDestroyAllocator(vk.allocator);
@@ -550,14 +773,34 @@ void vk_shutdown() {
     vkDestroyInstance(vk.instance, nullptr);
 }
 
-void vk_release_resolution_dependent_resources() {
-    destroy_swapchain();
-    destroy_depth_buffer();
-}
+void vk_recreate_resolution_dependent_resources(bool vsync) {
+    const Swapchain_Info old_swapchain = vk.swapchain_info;
+    const Depth_Buffer_Info old_depth_info = vk.depth_info;
 
-void vk_restore_resolution_dependent_resources(bool vsync) {
-    create_swapchain(vsync);
+    vk.swapchain_info = Swapchain_Info{};
+    vk.depth_info = Depth_Buffer_Info{};
+    vk.swapchain_recreate_requested = false;
+    create_swapchain(vsync, old_swapchain.handle);
     create_depth_buffer();
+
+    for (VkImageView image_view : old_swapchain.image_views)
+        vk_destroy_deferred(image_view);
+    vk_destroy_deferred(old_swapchain.handle);
+
+    vk_destroy_deferred(old_depth_info.image_view);
+    vk_destroy_deferred(old_depth_info.image, old_depth_info.allocation);
+}
+
+VkDeviceSize vk_get_depth_buffer_committed_size() {
+    if (!vk.depth_info.lazily_allocated)
+        return vk.depth_info.memory_size;
+
+    VmaAllocationInfo allocation_info;
+    vmaGetAllocationInfo(vk.allocator, vk.depth_info.allocation, &allocation_info);
+
+    VkDeviceSize committed_size = 0;
+    vkGetDeviceMemoryCommitment(vk.device, allocation_info.deviceMemory, &committed_size);
+    return committed_size;
 }
 
 void vk_ensure_staging_buffer_allocation(VkDeviceSize size) {
@@ -792,10 +1035,13 @@ VkShaderModule vk_load_spirv(const std::string& spirv_file) {
     if (bytes.size() % 4 != 0) {
         error("Vulkan: SPIR-V binary buffer size is not multiple of 4");
     }
+    return vk_create_shader_module(reinterpret_cast<const uint32_t*>(bytes.data()), bytes.size());
+}
 
+VkShaderModule vk_create_shader_module(const uint32_t* spirv, size_t spirv_size_in_bytes) {
     VkShaderModuleCreateInfo create_info { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO } ;
-    create_info.codeSize = bytes.size();
-    create_info.pCode = reinterpret_cast<const uint32_t*>(bytes.data());
+    create_info.codeSize = spirv_size_in_bytes;
+    create_info.pCode = spirv;
 
     VkShaderModule shader_module;
     VK_CHECK(vkCreateShaderModule(vk.device, &create_info, nullptr, &shader_module));
@@ -922,13 +1168,15 @@ VkPipeline vk_create_graphics_pipeline(
     VkPipelineLayout                    pipeline_layout,
     VkRenderPass                        render_pass,
     VkShaderModule                      vertex_shader,
-    VkShaderModule                      fragment_shader)
+    VkShaderModule                      fragment_shader,
+    const VkSpecializationInfo*         specialization_info)
 {
-    auto get_shader_stage_create_info = [](VkShaderStageFlagBits stage, VkShaderModule shader_module) {
+    auto get_shader_stage_create_info = [specialization_info](VkShaderStageFlagBits stage, VkShaderModule shader_module) {
         VkPipelineShaderStageCreateInfo create_info{ VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
-        create_info.stage  = stage;
-        create_info.module = shader_module;
-        create_info.pName  = "main";
+        create_info.stage               = stage;
+        create_info.module              = shader_module;
+        create_info.pName               = "main";
+        create_info.pSpecializationInfo = specialization_info;
         return create_info;
     };
 
@@ -954,7 +1202,7 @@ VkPipeline vk_create_graphics_pipeline(
     dynamic_state_create_info.pDynamicStates            = state.dynamic_state;
 
     VkGraphicsPipelineCreateInfo create_info { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
-    create_info.stageCount                              = (uint32_t)std::size(shader_stages_state);
+    create_info.stageCount                              = (fragment_shader != VK_NULL_HANDLE) ? 2 : 1;
     create_info.pStages                                 = shader_stages_state;
     create_info.pVertexInputState                       = &vertex_input_state;
     create_info.pInputAssemblyState                     = &state.input_assembly_state;
@@ -969,30 +1217,86 @@ VkPipeline vk_create_graphics_pipeline(
     create_info.subpass                                 = 0;
 
     VkPipeline pipeline;
-    VK_CHECK(vkCreateGraphicsPipelines(vk.device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pipeline));
+    VK_CHECK(vkCreateGraphicsPipelines(vk.device, vk.pipeline_cache, 1, &create_info, nullptr, &pipeline));
     return pipeline;
 }
 
-void vk_begin_frame() {
+VkPipeline vk_create_compute_pipeline(
+    VkPipelineLayout                    pipeline_layout,
+    VkShaderModule                      compute_shader,
+    const VkSpecializationInfo*         specialization_info,
+    const char*                         name)
+{
+    VkPipelineShaderStageCreateInfo compute_stage { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+    compute_stage.stage                 = VK_SHADER_STAGE_COMPUTE_BIT;
+    compute_stage.module                = compute_shader;
+    compute_stage.pName                 = "main";
+    compute_stage.pSpecializationInfo   = specialization_info;
+
+    VkComputePipelineCreateInfo create_info{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    create_info.stage   = compute_stage;
+    create_info.layout  = pipeline_layout;
+
+    VkPipeline pipeline;
+    VK_CHECK(vkCreateComputePipelines(vk.device, vk.pipeline_cache, 1, &create_info, nullptr, &pipeline));
+    vk_set_debug_name(pipeline, name);
+    return pipeline;
+}
+
+void vk_wait_for_frame() {
+    CPU_TIME_SCOPE("vk_wait_for_frame");
     VK_CHECK(vkWaitForFences(vk.device, 1, &vk.frame_fence[vk.frame_index], VK_FALSE, std::numeric_limits<uint64_t>::max()));
+
+    // All frames except the last submitted one are finished now.
+    if (vk.submitted_frame_count > 0) {
+        vk.finished_frame_count = std::max(vk.finished_frame_count, vk.submitted_frame_count - 1);
+        const uint64_t finished_frame_count = vk.finished_frame_count;
+        auto it = std::remove_if(vk.retired_objects.begin(), vk.retired_objects.end(), [finished_frame_count](const Vk_Retired_Object& retired) {
+            if (retired.frame >= finished_frame_count)
+                return false;
+            destroy_retired_object(retired);
+            return true;
+        });
+        vk.retired_objects.erase(it, vk.retired_objects.end());
+    }
+}
+
+bool vk_begin_frame() {
+    vk_wait_for_frame(); // returns immediately if the caller has already waited
+
+    VkResult result;
+    {
+        CPU_TIME_SCOPE("vkAcquireNextImageKHR");
+        result = vkAcquireNextImageKHR(vk.device, vk.swapchain_info.handle, UINT64_MAX, vk.image_acquired_semaphore[vk.frame_index], VK_NULL_HANDLE, &vk.swapchain_image_index);
+    }
+    // The frame fence is not reset yet, so the frame slot stays usable by the next frame.
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        vk.swapchain_recreate_requested = true;
+        return false;
+    }
+    // The image is acquired and can still be presented, the swapchain is recreated after the frame.
+    if (result == VK_SUBOPTIMAL_KHR)
+        vk.swapchain_recreate_requested = true;
+    VK_CHECK_RESULT(result);
+
     VK_CHECK(vkResetFences(vk.device, 1, &vk.frame_fence[vk.frame_index]));
     vkResetCommandPool(vk.device, vk.command_pools[vk.frame_index], 0);
-    vk.command_buffer = vk.command_buffers[vk.frame_index];
-    vk.timestamp_query_pool = vk.timestamp_query_pools[vk.frame_index];
 
-    START_TIMER
-    VK_CHECK(vkAcquireNextImageKHR(vk.device, vk.swapchain_info.handle, UINT64_MAX, vk.image_acquired_semaphore[vk.frame_index], VK_NULL_HANDLE, &vk.swapchain_image_index));
-    STOP_TIMER("vkAcquireNextImageKHR")
+    vk.command_buffer = vk.command_buffers[vk.frame_index];
+    vk.frame_descriptor_allocator = &vk.frame_descriptor_allocators[vk.frame_index];
+    vk.frame_descriptor_allocator->reset();
 
     VkCommandBufferBeginInfo begin_info { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     VK_CHECK(vkBeginCommandBuffer(vk.command_buffer, &begin_info));
+    return true;
 }
 
 void vk_end_frame() {
     VK_CHECK(vkEndCommandBuffer(vk.command_buffer));
 
-    const VkPipelineStageFlags wait_dst_stage_mask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    // Swapchain image can be written by compute copy, blit or render pass.
+    const VkPipelineStageFlags wait_dst_stage_mask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 
     VkSubmitInfo submit_info { VK_STRUCTURE_TYPE_SUBMIT_INFO };
     submit_info.waitSemaphoreCount   = 1;
@@ -1003,9 +1307,11 @@ void vk_end_frame() {
     submit_info.signalSemaphoreCount = 1;
     submit_info.pSignalSemaphores    = &vk.rendering_finished_semaphore[vk.frame_index];
 
-    START_TIMER
-    VK_CHECK(vkQueueSubmit(vk.queue, 1, &submit_info, vk.frame_fence[vk.frame_index]));
-    STOP_TIMER("vkQueueSubmit")
+    {
+        CPU_TIME_SCOPE("vkQueueSubmit");
+        VK_CHECK(vkQueueSubmit(vk.queue, 1, &submit_info, vk.frame_fence[vk.frame_index]));
+    }
+    vk.submitted_frame_count++;
 
     VkPresentInfoKHR present_info { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
     present_info.waitSemaphoreCount = 1;
@@ -1014,13 +1320,82 @@ void vk_end_frame() {
     present_info.pSwapchains        = &vk.swapchain_info.handle;
     present_info.pImageIndices      = &vk.swapchain_image_index;
 
-    START_TIMER
-    VK_CHECK(vkQueuePresentKHR(vk.queue, &present_info));
-    STOP_TIMER("vkQueuePresentKHR")
+    VkResult result;
+    {
+        CPU_TIME_SCOPE("vkQueuePresentKHR");
+        result = vkQueuePresentKHR(vk.queue, &present_info);
+    }
+    // The rendering finished semaphore is still waited on OUT_OF_DATE, the frame slot can be reused.
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+        vk.swapchain_recreate_requested = true;
+    else
+        VK_CHECK_RESULT(result);
 
     vk.frame_index = 1 - vk.frame_index;
 }
 
+bool vk_is_frame_finished(uint64_t frame) {
+    if (frame < vk.finished_frame_count)
+        return true;
+    if (frame >= vk.submitted_frame_count)
+        return false;
+
+    // The frame was not waited by vk_wait_for_frame, so its fence is not reset yet. Frame slots
+    // are used in submission order: frame_index changes together with submitted_frame_count.
+    const size_t slot = frame % std::size(vk.frame_fence);
+    if (vkGetFenceStatus(vk.device, vk.frame_fence[slot]) != VK_SUCCESS)
+        return false;
+
+    vk.finished_frame_count = frame + 1; // the queue executes frames in order
+    return true;
+}
+
+static void retire_object(const Vk_Retired_Object& object) {
+    if (object.handle == 0)
+        return;
+    vk.retired_objects.push_back(object);
+    vk.retired_objects.back().frame = vk.submitted_frame_count;
+}
+
+void vk_destroy_deferred(VkObjectType type, uint64_t handle) {
+    Vk_Retired_Object object{};
+    object.type     = type;
+    object.handle   = handle;
+    retire_object(object);
+}
+
+void vk_destroy_deferred(Vk_Image& image) {
+    vk_destroy_deferred(image.view);
+    vk_destroy_deferred(image.handle, image.allocation);
+    image = Vk_Image{};
+}
+
+void vk_destroy_deferred(Vk_Buffer& buffer) {
+    Vk_Retired_Object object{};
+    object.type         = VK_OBJECT_TYPE_BUFFER;
+    object.handle       = (uint64_t)buffer.handle;
+    object.allocation   = buffer.allocation;
+    retire_object(object);
+    buffer = Vk_Buffer{};
+}
+
+void vk_destroy_deferred(VkImage image, VmaAllocation allocation) {
+    Vk_Retired_Object object{};
+    object.type         = VK_OBJECT_TYPE_IMAGE;
+    object.handle       = (uint64_t)image;
+    object.allocation   = allocation;
+    retire_object(object);
+}
+
+void vk_destroy_deferred(Vk_Descriptor_Allocator& allocator, VkDescriptorSetLayout set_layout, VkDescriptorSet set) {
+    Vk_Retired_Object object{};
+    object.type                 = VK_OBJECT_TYPE_DESCRIPTOR_SET;
+    object.handle               = (uint64_t)set;
+    object.descriptor_allocator = &allocator;
+    object.set_layout           = set_layout;
+    retire_object(object);
+}
+
 void vk_execute(VkCommandPool command_pool, VkQueue queue, std::function<void(VkCommandBuffer)> recorder) {
 
     VkCommandBufferAllocateInfo alloc_info { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
@@ -1091,11 +1466,3 @@ void vk_cmd_image_barrier_for_subresource(
     vkCmdPipelineBarrier(command_buffer, src_stage_mask, dst_stage_mask, 0,
         0, nullptr, 0, nullptr, 1, &barrier);
 }
-
-uint32_t vk_allocate_timestamp_queries(uint32_t count) {
-    assert(count > 0);
-    assert(vk.timestamp_query_count + count <= max_timestamp_queries);
-    uint32_t first_query = vk.timestamp_query_count;
-    vk.timestamp_query_count += count;
-    return first_query;
-}
@@ -30,6 +30,39 @@ struct Vk_Buffer {
     void destroy();
 };
 
+// Allocates descriptor sets from a chain of descriptor pools. When the current pool is exhausted
+// the next pool is used, new pools are created on demand. reset() returns all sets at once and
+// keeps the pools for reuse. Not thread safe.
+struct Vk_Descriptor_Allocator {
+    std::vector<VkDescriptorPool>   pools;
+    uint32_t                        current_pool;
+    uint32_t                        sets_per_pool;
+    uint32_t                        allocated_set_count; // since the last reset
+    uint32_t                        max_allocated_set_count; // the largest allocated_set_count observed
+    std::string                     name;
+    std::vector<std::pair<VkDescriptorSetLayout, VkDescriptorSet>> free_sets; // reused by allocate()
+
+    void create(uint32_t sets_per_pool, const char* name);
+    void destroy();
+    VkDescriptorSet allocate(VkDescriptorSetLayout set_layout);
+    // Pools don't support individual frees, the set is kept for the next allocation with the same layout.
+    void free(VkDescriptorSetLayout set_layout, VkDescriptorSet set);
+    void reset();
+
+private:
+    void create_pool();
+};
+
+// Object passed to vk_destroy_deferred.
+struct Vk_Retired_Object {
+    uint64_t                        frame; // vk.submitted_frame_count at the moment of retirement
+    VkObjectType                    type;
+    uint64_t                        handle;
+    VmaAllocation                   allocation; // images and buffers
+    Vk_Descriptor_Allocator*        descriptor_allocator; // descriptor sets
+    VkDescriptorSetLayout           set_layout; // descriptor sets
+};
+
 struct Vk_Graphics_Pipeline_State {
     VkVertexInputBindingDescription         vertex_bindings[8];
     uint32_t                                vertex_binding_count;
@@ -46,17 +79,30 @@ struct Vk_Graphics_Pipeline_State {
     uint32_t                                dynamic_state_count;
 };
 
+// Transient depth is never stored and can't be sampled, so it can live in lazily allocated
+// memory that tile-based GPUs keep on chip. Depth-only format is chosen when stencil is not needed.
+struct Depth_Buffer_Policy {
+    bool                    stencil     = false;
+    bool                    transient   = false;
+};
+
 struct GLFWwindow;
 
 // Initializes VK_Instance structure.
 // After calling this function we get fully functional vulkan subsystem.
-void vk_initialize(GLFWwindow* window, bool enable_validation_layers);
+void vk_initialize(GLFWwindow* window, bool enable_validation_layers, const Depth_Buffer_Policy& depth_policy);
 
 // Shutdown vulkan subsystem by releasing resources acquired by Vk_Instance.
 void vk_shutdown();
 
-void vk_release_resolution_dependent_resources();
-void vk_restore_resolution_dependent_resources(bool vsync);
+// Recreates swapchain and depth buffer without waiting for the GPU. The new swapchain is created
+// with oldSwapchain, the retired swapchain and depth buffer are passed to vk_destroy_deferred.
+// The depth buffer is in UNDEFINED layout after creation, the first render pass should clear it.
+void vk_recreate_resolution_dependent_resources(bool vsync);
+
+// Returns the amount of memory backing the depth buffer. For lazily allocated memory
+// it is the memory committed by the driver, which can be zero.
+VkDeviceSize vk_get_depth_buffer_committed_size();
 
 void vk_ensure_staging_buffer_allocation(VkDeviceSize size);
 Vk_Buffer vk_create_buffer(VkDeviceSize size, VkBufferUsageFlags usage, const char* name);
@@ -65,21 +111,65 @@ Vk_Image vk_create_texture(int width, int height, VkFormat format, bool generate
 Vk_Image vk_create_image(int width, int height, VkFormat format, VkImageCreateFlags usage_flags, const char* name);
 Vk_Image vk_load_texture(const std::string& texture_file);
 VkShaderModule vk_load_spirv(const std::string& spirv_file);
+VkShaderModule vk_create_shader_module(const uint32_t* spirv, size_t spirv_size_in_bytes);
 
 Vk_Graphics_Pipeline_State get_default_graphics_pipeline_state();
 
+// specialization_info (optional) is applied to all shader stages.
+// fragment_shader can be VK_NULL_HANDLE for depth-only pipelines.
 VkPipeline vk_create_graphics_pipeline(
     const Vk_Graphics_Pipeline_State&   state,
     VkPipelineLayout                    pipeline_layout,
     VkRenderPass                        render_pass,
     VkShaderModule                      vertex_shader,
-    VkShaderModule                      fragment_shader
+    VkShaderModule                      fragment_shader,
+    const VkSpecializationInfo*         specialization_info = nullptr
 );
 
+VkPipeline vk_create_compute_pipeline(
+    VkPipelineLayout                    pipeline_layout,
+    VkShaderModule                      compute_shader,
+    const VkSpecializationInfo*         specialization_info,
+    const char*                         name
+);
 
-void vk_begin_frame();
+
+// Waits for the fence of the frame slot that the next vk_begin_frame uses. Allows to block
+// on the GPU before input is sampled, vk_begin_frame also calls it.
+void vk_wait_for_frame();
+// Returns false if the swapchain is out of date and no image was acquired. The frame is skipped,
+// vk.swapchain_recreate_requested is set and nothing should be recorded.
+bool vk_begin_frame();
 void vk_end_frame();
 
+// Returns true if the GPU has finished the frame. The frame is identified by the value of
+// vk.submitted_frame_count when it was recorded. Does not block.
+bool vk_is_frame_finished(uint64_t frame);
+
+// Deferred destruction. The object is tagged with vk.submitted_frame_count and destroyed in
+// vk_begin_frame when the frame that was being recorded at the moment of the call is finished,
+// so objects used by the frames in flight, including the current one, can be released without
+// waiting for the GPU. Null handles are ignored.
+void vk_destroy_deferred(VkObjectType type, uint64_t handle);
+void vk_destroy_deferred(Vk_Image& image);
+void vk_destroy_deferred(Vk_Buffer& buffer);
+void vk_destroy_deferred(VkImage image, VmaAllocation allocation);
+// The set is returned to the allocator with Vk_Descriptor_Allocator::free.
+void vk_destroy_deferred(Vk_Descriptor_Allocator& allocator, VkDescriptorSetLayout set_layout, VkDescriptorSet set);
+
+template <typename Vk_Object_Type>
+void vk_destroy_deferred(Vk_Object_Type object) {
+    VkObjectType type;
+    if constexpr (std::is_same<Vk_Object_Type, VkPipeline>::value)              type = VK_OBJECT_TYPE_PIPELINE;
+    else if constexpr (std::is_same<Vk_Object_Type, VkImageView>::value)        type = VK_OBJECT_TYPE_IMAGE_VIEW;
+    else if constexpr (std::is_same<Vk_Object_Type, VkFramebuffer>::value)      type = VK_OBJECT_TYPE_FRAMEBUFFER;
+    else if constexpr (std::is_same<Vk_Object_Type, VkSampler>::value)          type = VK_OBJECT_TYPE_SAMPLER;
+    else if constexpr (std::is_same<Vk_Object_Type, VkBufferView>::value)       type = VK_OBJECT_TYPE_BUFFER_VIEW;
+    else if constexpr (std::is_same<Vk_Object_Type, VkSwapchainKHR>::value)     type = VK_OBJECT_TYPE_SWAPCHAIN_KHR;
+    else static_assert(sizeof(Vk_Object_Type) == 0, "vk_destroy_deferred: unsupported object type");
+    vk_destroy_deferred(type, (uint64_t)object);
+}
+
 void vk_execute(VkCommandPool command_pool, VkQueue queue, std::function<void(VkCommandBuffer)> recorder);
 
 // Barrier for all subresources of non-depth image.
@@ -98,8 +188,6 @@ void vk_cmd_image_barrier_for_subresource(
     VkImageLayout           old_layout,         VkImageLayout           new_layout
 );
 
-uint32_t vk_allocate_timestamp_queries(uint32_t count);
-
 template <typename Vk_Object_Type>
 void vk_set_debug_name(Vk_Object_Type object, const char* name) {
     VkDebugUtilsObjectNameInfoEXT name_info { VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT };
@@ -158,6 +246,11 @@ struct Depth_Buffer_Info {
     VkImageView             image_view;
     VmaAllocation           allocation;
     VkFormat                format;
+    bool                    has_stencil;
+    bool                    transient;
+    bool                    lazily_allocated;
+    VkDeviceSize            memory_size;
+    VkDeviceSize            baseline_memory_size; // estimated D24S8/D32S8 non-transient image of the same size
 };
 
 // Vk_Instance contains vulkan resources that do not depend on applicaton logic.
@@ -178,21 +271,31 @@ struct Vk_Instance {
     Swapchain_Info                  swapchain_info;
 
     uint32_t                        swapchain_image_index = -1; // current swapchain image
+    bool                            swapchain_recreate_requested = false; // acquire or present reported OUT_OF_DATE or SUBOPTIMAL
 
     VkCommandPool                   command_pools[2];
     VkCommandBuffer                 command_buffers[2];
     VkCommandBuffer                 command_buffer; // command_buffers[frame_index]
     int                             frame_index;
 
-    VkDescriptorPool                descriptor_pool;
+    Vk_Descriptor_Allocator         descriptor_allocator; // for sets that live until they are explicitly released
+    Vk_Descriptor_Allocator         frame_descriptor_allocators[2]; // reset when the frame fence is signaled
+    Vk_Descriptor_Allocator*        frame_descriptor_allocator; // frame_descriptor_allocators[frame_index]
+    bool                            push_descriptors_supported; // VK_KHR_push_descriptor
+    bool                            draw_indirect_count_supported; // VK_KHR_draw_indirect_count
+    bool                            multi_draw_indirect_supported; // multiDrawIndirect and drawIndirectFirstInstance features
+    bool                            storage_image_array_indexing_supported; // shaderStorageImageArrayDynamicIndexing feature
+    bool                            pipeline_statistics_supported; // pipelineStatisticsQuery feature
+    bool                            calibrated_timestamps_supported; // VK_EXT_calibrated_timestamps with device time domain
+    VkPipelineCache                 pipeline_cache; // internally synchronized, can be used by multiple threads
 
     VkSemaphore                     image_acquired_semaphore[2];
     VkSemaphore                     rendering_finished_semaphore[2];
     VkFence                         frame_fence[2];
+    uint64_t                        submitted_frame_count = 0;
+    uint64_t                        finished_frame_count = 0; // frames [0, finished_frame_count) are known to be finished
 
-    VkQueryPool                     timestamp_query_pools[2];
-    VkQueryPool                     timestamp_query_pool; // timestamp_query_pool[frame_index]
-    uint32_t                        timestamp_query_count;
+    std::vector<Vk_Retired_Object>  retired_objects; // passed to vk_destroy_deferred
 
     // Host visible memory used to copy image data to device local memory.
     VkBuffer                        staging_buffer;
@@ -200,7 +303,9 @@ struct Vk_Instance {
     VkDeviceSize                    staging_buffer_size;
     uint8_t*                        staging_buffer_ptr; // pointer to mapped staging buffer
 
+    Depth_Buffer_Policy             depth_policy;
     Depth_Buffer_Info               depth_info;
+    double                          depth_baseline_bytes_per_pixel; // D24S8/D32S8 non-transient image, measured at initialization
     VkDebugUtilsMessengerEXT        debug_utils_messenger;
 };
 
@@ -20,4 +20,12 @@ void sleep(int milliseconds) {
     ::Sleep(milliseconds);
 }
 
+double get_process_cpu_time_seconds() {
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!::GetProcessTimes(::GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+        return 0.0;
+    auto to_100ns = [](FILETIME t) { return (uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime; };
+    return double(to_100ns(kernel_time) + to_100ns(user_time)) * 1e-7;
+}
+
 } // namespace platform